@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace packer {
+
+// Archives start with a magic number followed by a 16 bit little-endian set of format flags.
+// Archives written before the header was introduced start directly with the first entry; their
+// first byte is always a file_type value, which can never be mistaken for the magic number.
+constexpr std::array<char, 4> ARCHIVE_MAGIC = {'P', 'A', 'K', 'R'};
+
+// bits of the format flags field in the archive header
+enum archive_flags : std::uint16_t {
+    // regular file data length is followed by an 8 byte checksum of the file content
+    ARCHIVE_FLAG_CHECKSUMS = 1u << 0,
+    // file data is kept in a blob store and referred to by blob_ref entries; the header is
+    // followed by the 16 byte id the archive is registered under in the store
+    ARCHIVE_FLAG_BLOB_REFS = 1u << 1,
+    // entry names are interned in a string table built while reading the archive: the type
+    // byte is followed by a varint name code, (length << 1) for a new name whose bytes follow
+    // and get the next id, or (id << 1 | 1) for a name seen before; the depth decrease of
+    // leave_directory entries and the target length of symlinks are varints as well
+    ARCHIVE_FLAG_NAME_TABLE = 1u << 2,
+};
+
+// flags understood by this version of the packer
+constexpr std::uint16_t ARCHIVE_KNOWN_FLAGS =
+    ARCHIVE_FLAG_CHECKSUMS | ARCHIVE_FLAG_BLOB_REFS | ARCHIVE_FLAG_NAME_TABLE;
+
+} // namespace packer
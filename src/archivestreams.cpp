@@ -0,0 +1,233 @@
+#include "archivestreams.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace packer {
+
+namespace {
+
+// absolute position requested by a seekoff call, or -1 if it lies outside [0, end]
+std::streamoff seekTarget(std::streamoff off, std::ios_base::seekdir dir, std::streamoff current,
+                          std::streamoff end) {
+    std::streamoff base = 0;
+    if (dir == std::ios_base::cur) {
+        base = current;
+    } else if (dir == std::ios_base::end) {
+        base = end;
+    }
+    const std::streamoff target = base + off;
+    return (target < 0 || target > end) ? -1 : target;
+}
+
+} // namespace
+
+// MemorySinkBuf
+
+std::streamsize MemorySinkBuf::xsputn(const char* s, std::streamsize n) {
+    buffer_.insert(buffer_.end(), s, s + n);
+    return n;
+}
+
+MemorySinkBuf::int_type MemorySinkBuf::overflow(int_type ch) {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        buffer_.push_back(traits_type::to_char_type(ch));
+    }
+    return traits_type::not_eof(ch);
+}
+
+MemorySinkBuf::pos_type MemorySinkBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                               std::ios_base::openmode which) {
+    if (!(which & std::ios_base::out)) {
+        return pos_type(off_type(-1));
+    }
+    const auto size = static_cast<std::streamoff>(buffer_.size());
+    const std::streamoff target = seekTarget(off, dir, size, size);
+    if (target >= 0) {
+        buffer_.resize(static_cast<std::size_t>(target));
+    }
+    return pos_type(target);
+}
+
+MemorySinkBuf::pos_type MemorySinkBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+// CallbackSinkBuf
+
+CallbackSinkBuf::CallbackSinkBuf(WriteCallback callback, std::size_t buffer_size)
+    : callback_(std::move(callback)), buffer_(std::max<std::size_t>(buffer_size, 1)) {
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+CallbackSinkBuf::~CallbackSinkBuf() {
+    try {
+        deliverPending();
+    } catch (...) {
+        // destructors must not throw
+    }
+}
+
+void CallbackSinkBuf::deliverPending() {
+    const std::size_t pending = static_cast<std::size_t>(pptr() - pbase());
+    if (pending > 0) {
+        callback_(pbase(), pending);
+        delivered_ += pending;
+    }
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+std::streamsize CallbackSinkBuf::xsputn(const char* s, std::streamsize n) {
+    const auto size = static_cast<std::size_t>(n);
+    if (size <= static_cast<std::size_t>(epptr() - pptr())) {
+        std::memcpy(pptr(), s, size);
+        pbump(static_cast<int>(size));
+        return n;
+    }
+    // does not fit: hand over what is pending, then either buffer or pass the data straight on
+    deliverPending();
+    if (size < buffer_.size()) {
+        std::memcpy(pptr(), s, size);
+        pbump(static_cast<int>(size));
+    } else {
+        callback_(s, size);
+        delivered_ += size;
+    }
+    return n;
+}
+
+CallbackSinkBuf::int_type CallbackSinkBuf::overflow(int_type ch) {
+    deliverPending();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int CallbackSinkBuf::sync() {
+    deliverPending();
+    return 0;
+}
+
+CallbackSinkBuf::pos_type CallbackSinkBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                                   std::ios_base::openmode which) {
+    const auto end = static_cast<std::streamoff>(delivered_) + (pptr() - pbase());
+    const std::streamoff target = seekTarget(off, dir, end, end);
+    if (!(which & std::ios_base::out) || target < static_cast<std::streamoff>(delivered_)) {
+        return pos_type(off_type(-1)); // data already handed over cannot be taken back
+    }
+    pbump(static_cast<int>(target - end));
+    return pos_type(target);
+}
+
+CallbackSinkBuf::pos_type CallbackSinkBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+// SpanSourceBuf
+
+SpanSourceBuf::SpanSourceBuf(const char* data, std::size_t size) {
+    // the get area is never written to, the const_cast only satisfies the streambuf interface
+    char* begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+}
+
+SpanSourceBuf::pos_type SpanSourceBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                               std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    const std::streamoff target = seekTarget(off, dir, gptr() - eback(), egptr() - eback());
+    if (target >= 0) {
+        setg(eback(), eback() + target, egptr());
+    }
+    return pos_type(target);
+}
+
+SpanSourceBuf::pos_type SpanSourceBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+// CallbackSourceBuf
+
+CallbackSourceBuf::CallbackSourceBuf(ReadCallback callback, std::size_t buffer_size)
+    : callback_(std::move(callback)), buffer_(std::max<std::size_t>(buffer_size, 1)) {
+    setg(buffer_.data(), buffer_.data(), buffer_.data());
+}
+
+std::uint64_t CallbackSourceBuf::position() const {
+    return buffer_offset_ + static_cast<std::uint64_t>(gptr() - eback());
+}
+
+CallbackSourceBuf::int_type CallbackSourceBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    buffer_offset_ = position();
+    const std::size_t bytes_read = callback_(buffer_offset_, buffer_.data(), buffer_.size());
+    setg(buffer_.data(), buffer_.data(), buffer_.data() + bytes_read);
+    if (bytes_read == 0) {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize CallbackSourceBuf::xsgetn(char* s, std::streamsize n) {
+    // serve what is buffered, then read large requests directly into the caller's memory
+    std::streamsize copied = std::min<std::streamsize>(n, egptr() - gptr());
+    std::memcpy(s, gptr(), static_cast<std::size_t>(copied));
+    gbump(static_cast<int>(copied));
+    while (copied < n) {
+        const auto remaining = static_cast<std::size_t>(n - copied);
+        if (remaining < buffer_.size()) {
+            if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+                break;
+            }
+            const std::streamsize chunk =
+                std::min<std::streamsize>(n - copied, egptr() - gptr());
+            std::memcpy(s + copied, gptr(), static_cast<std::size_t>(chunk));
+            gbump(static_cast<int>(chunk));
+            copied += chunk;
+        } else {
+            const std::uint64_t offset = position();
+            const std::size_t bytes_read = callback_(offset, s + copied, remaining);
+            if (bytes_read == 0) {
+                break;
+            }
+            copied += static_cast<std::streamsize>(bytes_read);
+            buffer_offset_ = offset + bytes_read;
+            setg(buffer_.data(), buffer_.data(), buffer_.data());
+        }
+    }
+    return copied;
+}
+
+CallbackSourceBuf::pos_type CallbackSourceBuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                                       std::ios_base::openmode which) {
+    // the archive size is unknown, seeking relative to its end is not supported
+    if (!(which & std::ios_base::in) || dir == std::ios_base::end) {
+        return pos_type(off_type(-1));
+    }
+    const auto current = static_cast<std::streamoff>(position());
+    const std::streamoff target = dir == std::ios_base::cur ? current + off : off;
+    if (target < 0) {
+        return pos_type(off_type(-1));
+    }
+    const auto buffer_start = static_cast<std::streamoff>(buffer_offset_);
+    if (target >= buffer_start && target <= buffer_start + (egptr() - eback())) {
+        setg(eback(), eback() + (target - buffer_start), egptr());
+    } else {
+        buffer_offset_ = static_cast<std::uint64_t>(target);
+        setg(buffer_.data(), buffer_.data(), buffer_.data());
+    }
+    return pos_type(target);
+}
+
+CallbackSourceBuf::pos_type CallbackSourceBuf::seekpos(pos_type pos,
+                                                       std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+} // namespace packer
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <streambuf>
+#include <vector>
+
+namespace packer {
+
+// Stream buffers used to pack into and unpack from places other than archive files.
+// Wrap them in a std::ostream / std::istream and pass the stream to Packer.
+//
+// Archive sinks are append-only: seeking backwards discards everything written after the new
+// position, which is exactly what Packer needs to roll back an entry that failed.
+
+// Sink appending the archive to a growable memory buffer owned by the caller
+class MemorySinkBuf : public std::streambuf {
+  public:
+    explicit MemorySinkBuf(std::vector<char>& buffer) : buffer_(buffer) {}
+
+  protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int_type overflow(int_type ch) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+  private:
+    std::vector<char>& buffer_;
+};
+
+// Sink handing the archive over to a user callback in order. Data is held back in a buffer
+// until the stream is flushed (Packer flushes after each entry) or the buffer is full; rolling
+// back past data already handed over fails.
+class CallbackSinkBuf : public std::streambuf {
+  public:
+    using WriteCallback = std::function<void(const char* data, std::size_t size)>;
+
+    static constexpr std::size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    explicit CallbackSinkBuf(WriteCallback callback,
+                             std::size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    // hands over any remaining data, errors are ignored - flush the stream to observe them
+    ~CallbackSinkBuf() override;
+
+  protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int_type overflow(int_type ch) override;
+    int sync() override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+  private:
+    void deliverPending();
+
+    WriteCallback callback_;
+    std::vector<char> buffer_;
+    // number of bytes already handed over to the callback
+    std::uint64_t delivered_ = 0;
+};
+
+// Source reading an archive from a contiguous memory region, which must outlive the buffer
+class SpanSourceBuf : public std::streambuf {
+  public:
+    SpanSourceBuf(const char* data, std::size_t size);
+
+  protected:
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
+// Source reading an archive through a positioned read callback (in the manner of pread),
+// which returns the number of bytes read and 0 at the end of the archive
+class CallbackSourceBuf : public std::streambuf {
+  public:
+    using ReadCallback = std::function<std::size_t(std::uint64_t offset, char* data,
+                                                   std::size_t size)>;
+
+    static constexpr std::size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    explicit CallbackSourceBuf(ReadCallback callback,
+                               std::size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+  protected:
+    int_type underflow() override;
+    std::streamsize xsgetn(char* s, std::streamsize n) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+  private:
+    // archive offset of the current read position
+    std::uint64_t position() const;
+
+    ReadCallback callback_;
+    std::vector<char> buffer_;
+    // archive offset of the first byte in the buffer
+    std::uint64_t buffer_offset_ = 0;
+};
+
+// Input stream over a contiguous memory region, which must outlive the stream
+class SpanIStream : public std::istream {
+  public:
+    SpanIStream(const char* data, std::size_t size) : std::istream(nullptr), buf_(data, size) {
+        rdbuf(&buf_);
+    }
+
+  private:
+    SpanSourceBuf buf_;
+};
+
+} // namespace packer
@@ -0,0 +1,415 @@
+#include "blobstore.h"
+
+#include "byteorder.h"
+#include "ifstream_exc.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#include <xxhash.h>
+
+namespace packer {
+
+namespace {
+
+// Index file: [4 bytes: magic "PKRS"][4 bytes: version]
+//             [8 bytes: blob count] blob count times:
+//                 [8 bytes: hash low][8 bytes: hash high][8 bytes: size]
+//                 [4 bytes: segment][8 bytes: offset][8 bytes: reference count]
+//             [8 bytes: archive count] archive count times: [16 bytes: archive id]
+constexpr char INDEX_MAGIC[4] = {'P', 'K', 'R', 'S'};
+constexpr std::uint32_t INDEX_VERSION = 1;
+constexpr const char* SEGMENT_EXTENSION = ".seg";
+
+void requireGood(const std::istream& index_in, const fs::path& index_path) {
+    if (!index_in) {
+        throw std::runtime_error("Blob store index is truncated: " + index_path.string());
+    }
+}
+
+// flush a file or directory to the storage
+void syncPath(const fs::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path.string());
+    }
+    const int result = ::fsync(fd);
+    const int error = errno;
+    ::close(fd);
+    if (result != 0) {
+        throw std::system_error(error, std::generic_category(), "Failed to sync " + path.string());
+    }
+}
+
+} // namespace
+
+BlobStore::BlobStore(fs::path root, store_access access)
+    : root_(std::move(root)), access_(access) {
+    const bool writable = access_ == store_access::read_write;
+    if (writable) {
+        fs::create_directories(root_ / "segments");
+    } else if (!fs::is_directory(root_ / "segments")) {
+        throw std::runtime_error("Blob store does not exist: " + root_.string());
+    }
+
+    // readers only need read access to the lock file, so read-only stores can be shared too
+    const fs::path lock_path = root_ / "lock";
+    lock_fd_ = writable ? ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666)
+                        : ::open(lock_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (lock_fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to open blob store lock " + lock_path.string());
+    }
+    if (::flock(lock_fd_, writable ? LOCK_EX : LOCK_SH) != 0) {
+        const int error = errno;
+        ::close(lock_fd_);
+        throw std::system_error(error, std::generic_category(),
+                                "Failed to lock blob store " + root_.string());
+    }
+
+    append_out_.exceptions(std::ios::failbit | std::ios::badbit);
+    try {
+        loadIndex();
+    } catch (...) {
+        ::close(lock_fd_);
+        throw;
+    }
+}
+
+BlobStore::~BlobStore() {
+    if (append_out_.is_open()) {
+        try {
+            append_out_.close();
+        } catch (const std::ios_base::failure&) {
+            // blobs not yet saved in the index are reclaimed by the next garbage collection
+        }
+    }
+    ::close(lock_fd_); // releases the lock
+}
+
+BlobKey BlobStore::computeKey(std::istream& data, std::uint64_t size, char* buffer,
+                              std::size_t buffer_size) {
+    std::unique_ptr<XXH3_state_t, decltype(&XXH3_freeState)> state(XXH3_createState(),
+                                                                   &XXH3_freeState);
+    if (!state) {
+        throw std::runtime_error("Failed to create XXH3 state");
+    }
+    XXH3_128bits_reset(state.get());
+
+    std::uint64_t remaining = size;
+    while (remaining > 0) {
+        const std::streamsize to_read =
+            static_cast<std::streamsize>(std::min<std::uint64_t>(remaining, buffer_size));
+        data.read(buffer, to_read);
+        if (data.gcount() != to_read) {
+            throw std::runtime_error("Unexpected EOF while hashing blob");
+        }
+        XXH3_128bits_update(state.get(), buffer, static_cast<std::size_t>(to_read));
+        remaining -= static_cast<std::uint64_t>(to_read);
+    }
+    const XXH128_hash_t hash = XXH3_128bits_digest(state.get());
+    return BlobKey{hash.low64, hash.high64, size};
+}
+
+bool BlobStore::contains(const BlobKey& key) const {
+    return blobs_.count(key) != 0;
+}
+
+void BlobStore::put(const BlobKey& key, std::istream& data) {
+    requireWritable();
+    if (contains(key)) {
+        return;
+    }
+    const BlobLocation location = append(data, key.size);
+    blobs_.emplace(key, location);
+}
+
+std::unique_ptr<std::istream> BlobStore::open(const BlobKey& key) {
+    const auto it = blobs_.find(key);
+    if (it == blobs_.end()) {
+        throw std::runtime_error("Blob not found in store " + root_.string());
+    }
+    if (append_out_.is_open() && it->second.segment == append_segment_) {
+        append_out_.flush(); // the blob may still be buffered
+    }
+    const fs::path segment_path = segmentPath(it->second.segment);
+    auto blob_in = std::make_unique<ifstream_exc>(segment_path, std::ios::binary);
+    if (!blob_in->is_open()) {
+        throw std::runtime_error("Failed to open blob store segment: " + segment_path.string());
+    }
+    blob_in->seekg(static_cast<std::streamoff>(it->second.offset));
+    return blob_in;
+}
+
+void BlobStore::registerArchive(const ArchiveId& archive_id, const BlobKeySet& keys) {
+    requireWritable();
+    if (!archives_.insert(archive_id).second) {
+        throw std::runtime_error("Archive is already registered in blob store " +
+                                 root_.string());
+    }
+    for (const BlobKey& key : keys) {
+        const auto it = blobs_.find(key);
+        if (it == blobs_.end()) {
+            throw std::runtime_error("Archive refers to a blob missing from store " +
+                                     root_.string());
+        }
+        ++it->second.ref_count;
+    }
+}
+
+bool BlobStore::releaseArchive(const ArchiveId& archive_id, const BlobKeySet& keys) {
+    requireWritable();
+    if (archives_.erase(archive_id) == 0) {
+        return false;
+    }
+    for (const BlobKey& key : keys) {
+        const auto it = blobs_.find(key);
+        if (it != blobs_.end() && it->second.ref_count > 0) {
+            --it->second.ref_count;
+        }
+    }
+    return true;
+}
+
+std::uint64_t BlobStore::collectGarbage() {
+    requireWritable();
+    if (append_out_.is_open()) {
+        append_out_.flush(); // segment sizes are taken from the files
+    }
+    // bytes still referenced in each segment
+    std::map<std::uint32_t, std::uint64_t> live_bytes;
+    for (const auto& [key, location] : blobs_) {
+        if (location.ref_count > 0) {
+            live_bytes[location.segment] += key.size;
+        }
+    }
+    // segments holding unreferenced blobs or leftovers of failed appends
+    std::vector<std::uint32_t> compacted;
+    std::uint64_t compacted_size = 0;
+    for (std::uint32_t segment : listSegments()) {
+        const std::uint64_t segment_size = fs::file_size(segmentPath(segment));
+        if (segment_size > live_bytes[segment]) {
+            compacted.push_back(segment);
+            compacted_size += segment_size;
+        }
+    }
+    if (compacted.empty()) {
+        return 0;
+    }
+
+    // copy live blobs out of the compacted segments into new ones
+    startNewSegment();
+    std::uint64_t copied_size = 0;
+    for (auto it = blobs_.begin(); it != blobs_.end();) {
+        BlobLocation& location = it->second;
+        if (!std::binary_search(compacted.begin(), compacted.end(), location.segment)) {
+            ++it;
+            continue;
+        }
+        if (location.ref_count == 0) {
+            it = blobs_.erase(it);
+            continue;
+        }
+        const std::unique_ptr<std::istream> blob_in = open(it->first);
+        const std::uint64_t ref_count = location.ref_count;
+        location = append(*blob_in, it->first.size);
+        location.ref_count = ref_count;
+        copied_size += it->first.size;
+        ++it;
+    }
+
+    // the index must no longer refer to the old segments before they are removed
+    save();
+    for (std::uint32_t segment : compacted) {
+        fs::remove(segmentPath(segment));
+    }
+    return compacted_size - copied_size;
+}
+
+// The index must never refer to data that could be lost in a crash: appended segment data is
+// synced before the new index, which replaces the old one only once it is synced itself.
+void BlobStore::save() {
+    requireWritable();
+    if (append_out_.is_open()) {
+        append_out_.flush();
+    }
+    if (!unsynced_segments_.empty()) {
+        for (std::uint32_t segment : unsynced_segments_) {
+            syncPath(segmentPath(segment));
+        }
+        syncPath(root_ / "segments"); // entries of new segment files
+        unsynced_segments_.clear();
+    }
+
+    const fs::path index_path = root_ / "index";
+    const fs::path temp_path = root_ / "index.tmp";
+    {
+        std::ofstream index_out;
+        index_out.exceptions(std::ios::failbit | std::ios::badbit);
+        index_out.open(temp_path, std::ios::binary | std::ios::trunc);
+        index_out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        write_le32(index_out, INDEX_VERSION);
+        write_le64(index_out, blobs_.size());
+        for (const auto& [key, location] : blobs_) {
+            write_le64(index_out, key.hash_low);
+            write_le64(index_out, key.hash_high);
+            write_le64(index_out, key.size);
+            write_le32(index_out, location.segment);
+            write_le64(index_out, location.offset);
+            write_le64(index_out, location.ref_count);
+        }
+        write_le64(index_out, archives_.size());
+        for (const ArchiveId& archive_id : archives_) {
+            index_out.write(reinterpret_cast<const char*>(archive_id.data()), archive_id.size());
+        }
+        index_out.close();
+    }
+    syncPath(temp_path);
+    fs::rename(temp_path, index_path);
+    syncPath(root_);
+}
+
+void BlobStore::requireWritable() const {
+    if (access_ != store_access::read_write) {
+        throw std::runtime_error("Blob store is opened read-only: " + root_.string());
+    }
+}
+
+fs::path BlobStore::segmentPath(std::uint32_t segment) const {
+    char name[16];
+    std::snprintf(name, sizeof(name), "%08u", static_cast<unsigned>(segment));
+    return root_ / "segments" / (std::string(name) + SEGMENT_EXTENSION);
+}
+
+std::vector<std::uint32_t> BlobStore::listSegments() const {
+    std::vector<std::uint32_t> segments;
+    for (const fs::directory_entry& entry : fs::directory_iterator(root_ / "segments")) {
+        const fs::path& path = entry.path();
+        if (path.extension() != SEGMENT_EXTENSION) {
+            continue;
+        }
+        try {
+            segments.push_back(static_cast<std::uint32_t>(std::stoul(path.stem().string())));
+        } catch (const std::logic_error&) {
+            // not a segment written by the store
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+void BlobStore::loadIndex() {
+    const fs::path index_path = root_ / "index";
+    if (!fs::exists(index_path)) {
+        return; // new store
+    }
+    ifstream_exc index_in(index_path, std::ios::binary);
+    char magic[sizeof(INDEX_MAGIC)] = {};
+    index_in.read(magic, sizeof(magic));
+    if (!index_in || !std::equal(magic, magic + sizeof(magic), INDEX_MAGIC)) {
+        throw std::runtime_error("Not a blob store index: " + index_path.string());
+    }
+    const std::uint32_t version = read_le32(index_in);
+    requireGood(index_in, index_path);
+    if (version != INDEX_VERSION) {
+        throw std::runtime_error("Unsupported blob store index version " +
+                                 std::to_string(version) + ": " + index_path.string());
+    }
+
+    const std::uint64_t blob_count = read_le64(index_in);
+    requireGood(index_in, index_path);
+    for (std::uint64_t i = 0; i < blob_count; ++i) {
+        BlobKey key;
+        BlobLocation location;
+        key.hash_low = read_le64(index_in);
+        key.hash_high = read_le64(index_in);
+        key.size = read_le64(index_in);
+        location.segment = read_le32(index_in);
+        location.offset = read_le64(index_in);
+        location.ref_count = read_le64(index_in);
+        requireGood(index_in, index_path);
+        blobs_.emplace(key, location);
+    }
+
+    const std::uint64_t archive_count = read_le64(index_in);
+    requireGood(index_in, index_path);
+    for (std::uint64_t i = 0; i < archive_count; ++i) {
+        ArchiveId archive_id{};
+        index_in.read(reinterpret_cast<char*>(archive_id.data()), archive_id.size());
+        requireGood(index_in, index_path);
+        archives_.insert(archive_id);
+    }
+}
+
+void BlobStore::openAppendSegment() {
+    if (append_out_.is_open() && append_size_ < SEGMENT_MAX_SIZE) {
+        return;
+    }
+    if (append_out_.is_open()) {
+        append_out_.close();
+        ++append_segment_;
+    } else if (append_segment_ == 0) {
+        // continue the last segment; segments with leftovers of failed appends are fine too
+        const std::vector<std::uint32_t> segments = listSegments();
+        append_segment_ = segments.empty() ? 1 : segments.back();
+    }
+
+    const fs::path segment_path = segmentPath(append_segment_);
+    append_size_ = fs::exists(segment_path) ? fs::file_size(segment_path) : 0;
+    if (append_size_ >= SEGMENT_MAX_SIZE) {
+        ++append_segment_;
+        append_size_ = 0;
+    }
+    append_out_.open(segmentPath(append_segment_), std::ios::binary | std::ios::app);
+}
+
+void BlobStore::startNewSegment() {
+    if (append_out_.is_open()) {
+        append_out_.close();
+    }
+    const std::vector<std::uint32_t> segments = listSegments();
+    append_segment_ = segments.empty() ? 1 : segments.back() + 1;
+    append_size_ = 0; // the segment file is created by the first append
+}
+
+BlobStore::BlobLocation BlobStore::append(std::istream& data, std::uint64_t size) {
+    openAppendSegment();
+    if (buffer_.empty()) {
+        buffer_.resize(CHUNK_SIZE);
+    }
+
+    const BlobLocation location{append_segment_, append_size_, 0};
+    unsynced_segments_.insert(append_segment_);
+    try {
+        std::uint64_t remaining = size;
+        while (remaining > 0) {
+            const std::streamsize to_read = static_cast<std::streamsize>(
+                std::min<std::uint64_t>(remaining, buffer_.size()));
+            data.read(buffer_.data(), to_read);
+            if (data.gcount() != to_read) {
+                throw std::runtime_error("Unexpected EOF while storing blob");
+            }
+            append_out_.write(buffer_.data(), to_read);
+            remaining -= static_cast<std::uint64_t>(to_read);
+        }
+    } catch (...) {
+        // partially written data is left for garbage collection, re-read the size on next use
+        append_out_.close();
+        append_segment_ = 0;
+        throw;
+    }
+    append_size_ += size;
+    return location;
+}
+
+} // namespace packer
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// identifies a blob by the XXH3-128 hash of its content and its size
+struct BlobKey {
+    std::uint64_t hash_low = 0;
+    std::uint64_t hash_high = 0;
+    std::uint64_t size = 0;
+
+    bool operator==(const BlobKey& other) const {
+        return hash_low == other.hash_low && hash_high == other.hash_high && size == other.size;
+    }
+};
+
+struct BlobKeyHash {
+    std::size_t operator()(const BlobKey& key) const {
+        return static_cast<std::size_t>(key.hash_low ^ (key.size * 0x9E3779B97F4A7C15ull));
+    }
+};
+
+using BlobKeySet = std::unordered_set<BlobKey, BlobKeyHash>;
+using ArchiveId = std::array<unsigned char, 16>;
+
+// how a blob store is opened
+enum class store_access {
+    // blobs are only read (unpack, export); readers share the store with each other
+    read_only,
+    // blobs and archives are added or removed (pack, release, gc); excludes all other users
+    read_write,
+};
+
+// Content-addressed store of file data shared by many archives.
+//
+// Blobs are appended to segment files in <root>/segments and located through <root>/index,
+// which also keeps a reference count per blob: the number of registered archives referring to
+// it. Archives register when packed against the store and are released explicitly; blobs left
+// without references are removed by collectGarbage, which compacts the affected segments.
+// The store is locked for the lifetime of the object, shared when opened read-only and
+// exclusively otherwise; changes to the index are persisted by save().
+class BlobStore {
+  public:
+    // open the store at `root`; opened for writing, an empty store is created if the directory
+    // does not exist, opened read-only the store must exist and modifying it throws
+    explicit BlobStore(fs::path root, store_access access = store_access::read_write);
+    ~BlobStore();
+
+    BlobStore(const BlobStore&) = delete;
+    BlobStore& operator=(const BlobStore&) = delete;
+
+    // compute the key of exactly `size` bytes read from `data` in chunks of `buffer_size` bytes
+    // through the caller's `buffer`
+    static BlobKey computeKey(std::istream& data, std::uint64_t size, char* buffer,
+                              std::size_t buffer_size);
+
+    bool contains(const BlobKey& key) const;
+    // append `key.size` bytes read from `data` as a new blob unless it is already stored
+    void put(const BlobKey& key, std::istream& data);
+    // open a stream positioned at the first byte of a stored blob
+    std::unique_ptr<std::istream> open(const BlobKey& key);
+
+    // register an archive referring to the given blobs, incrementing their reference counts
+    void registerArchive(const ArchiveId& archive_id, const BlobKeySet& keys);
+    // release a registered archive, decrementing the reference counts of its blobs;
+    // returns false if the archive was not registered (e.g. released before)
+    bool releaseArchive(const ArchiveId& archive_id, const BlobKeySet& keys);
+
+    // remove blobs without references and compact the segments they were stored in,
+    // returns the number of bytes reclaimed; the index is saved before segments are removed
+    std::uint64_t collectGarbage();
+
+    // persist the index, replacing the previous one atomically; blobs appended since the last
+    // save and the index itself are synced to the storage first
+    void save();
+
+    std::size_t blobCount() const { return blobs_.size(); }
+
+  private:
+    struct BlobLocation {
+        std::uint32_t segment = 0;
+        std::uint64_t offset = 0;
+        std::uint64_t ref_count = 0;
+    };
+
+    // segments are closed for appending once they reach this size
+    static constexpr std::uint64_t SEGMENT_MAX_SIZE = 1024ull * 1024 * 1024;
+    static constexpr std::size_t CHUNK_SIZE = 1024 * 1024;
+
+    // throw unless the store was opened for writing
+    void requireWritable() const;
+    fs::path segmentPath(std::uint32_t segment) const;
+    // ids of all segment files present in the store
+    std::vector<std::uint32_t> listSegments() const;
+    void loadIndex();
+    // make sure the append stream is open on a segment with room left
+    void openAppendSegment();
+    // close the append stream, the next append starts a segment after all existing ones
+    void startNewSegment();
+    // append `size` bytes read from `data` to the current segment, returns their location
+    BlobLocation append(std::istream& data, std::uint64_t size);
+
+    fs::path root_;
+    store_access access_;
+    int lock_fd_ = -1;
+    std::unordered_map<BlobKey, BlobLocation, BlobKeyHash> blobs_;
+    std::set<ArchiveId> archives_;
+    // segment new blobs are appended to and its current size, 0 if not chosen yet
+    std::uint32_t append_segment_ = 0;
+    std::uint64_t append_size_ = 0;
+    std::ofstream append_out_;
+    // segments appended to since the last save, synced before the index refers to them
+    std::set<std::uint32_t> unsynced_segments_;
+    std::vector<char> buffer_;
+};
+
+} // namespace packer
@@ -0,0 +1,95 @@
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#include <sys/mman.h>
+
+namespace packer {
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr)), data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)), capacity_(std::exchange(other.capacity_, 0)) {}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() { release(); }
+
+void BufferPool::Buffer::release() {
+    if (data_ != nullptr) {
+        pool_->giveBack(data_, capacity_);
+        data_ = nullptr;
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (const FreeBlock& block : free_) {
+        std::free(block.data);
+    }
+}
+
+BufferPool::Buffer BufferPool::acquire(std::size_t size) {
+    auto best = free_.end();
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+        if (it->capacity >= size && (best == free_.end() || it->capacity < best->capacity)) {
+            best = it;
+        }
+    }
+    if (best != free_.end()) {
+        const FreeBlock block = *best;
+        free_.erase(best);
+        return Buffer(this, block.data, size, block.capacity);
+    }
+
+    const std::size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    // aligned_alloc requires the size to be a multiple of the alignment
+    const std::size_t capacity = std::max<std::size_t>(
+        (size + alignment - 1) / alignment * alignment, alignment);
+    char* data = allocate(capacity);
+    ++allocation_count_;
+    return Buffer(this, data, size, capacity);
+}
+
+char* BufferPool::allocate(std::size_t capacity) {
+    const std::size_t alignment = capacity >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    void* data = std::aligned_alloc(alignment, capacity);
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (alignment == HUGE_PAGE_SIZE) {
+        // best-effort: without transparent huge pages the hint is ignored
+        ::madvise(data, capacity, MADV_HUGEPAGE);
+    }
+#endif
+    return static_cast<char*>(data);
+}
+
+void BufferPool::giveBack(char* data, std::size_t capacity) {
+    if (free_.size() < MAX_FREE_BUFFERS) {
+        free_.push_back({data, capacity});
+        return;
+    }
+    // keep the larger buffers, they are the expensive ones to allocate again
+    auto smallest = std::min_element(
+        free_.begin(), free_.end(),
+        [](const FreeBlock& a, const FreeBlock& b) { return a.capacity < b.capacity; });
+    if (smallest->capacity < capacity) {
+        std::swap(smallest->data, data);
+        smallest->capacity = capacity;
+    }
+    std::free(data);
+}
+
+} // namespace packer
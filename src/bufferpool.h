@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace packer {
+
+// Pool of reusable, page-aligned I/O buffers.
+//
+// Buffers are handed out as move-only leases that return their memory to the pool when they go
+// out of scope, so per-file chunk buffers cost an allocation only the first time a size is
+// needed. Buffers of at least HUGE_PAGE_SIZE bytes are aligned to huge pages and, where
+// supported, marked as huge page candidates. The pool is not thread-safe: every thread (e.g.
+// every Packer) owns its own pool, and leases must not outlive it.
+class BufferPool {
+  public:
+    static constexpr std::size_t PAGE_SIZE = 4096;
+    static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    // free buffers kept for reuse, further released buffers are freed
+    static constexpr std::size_t MAX_FREE_BUFFERS = 8;
+
+    class Buffer {
+      public:
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        ~Buffer();
+
+        char* data() const { return data_; }
+        // the requested size; the underlying capacity may be larger
+        std::size_t size() const { return size_; }
+
+      private:
+        friend class BufferPool;
+        Buffer(BufferPool* pool, char* data, std::size_t size, std::size_t capacity)
+            : pool_(pool), data_(data), size_(size), capacity_(capacity) {}
+        void release();
+
+        BufferPool* pool_ = nullptr;
+        char* data_ = nullptr;
+        std::size_t size_ = 0;
+        std::size_t capacity_ = 0;
+    };
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // a buffer of at least `size` bytes, reusing the smallest free buffer that is large enough
+    Buffer acquire(std::size_t size);
+
+    // number of buffers allocated so far, including those released again
+    std::size_t allocationCount() const { return allocation_count_; }
+
+  private:
+    struct FreeBlock {
+        char* data = nullptr;
+        std::size_t capacity = 0;
+    };
+
+    static char* allocate(std::size_t capacity);
+    void giveBack(char* data, std::size_t capacity);
+
+    std::vector<FreeBlock> free_;
+    std::size_t allocation_count_ = 0;
+};
+
+} // namespace packer
@@ -0,0 +1,154 @@
+#include "delta.h"
+
+#include "byteorder.h"
+#include "rollinghash.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace packer {
+
+namespace {
+
+enum delta_op : std::uint8_t {
+    DELTA_OP_COPY = 0,
+    DELTA_OP_INSERT = 1,
+};
+
+// matches are searched for at the granularity of base blocks of this size
+constexpr std::size_t BLOCK_SIZE = 16;
+
+void appendLe32(std::vector<char>& out, std::uint32_t value) {
+    const std::uint32_t le = to_le32(value);
+    const char* bytes = reinterpret_cast<const char*>(&le);
+    out.insert(out.end(), bytes, bytes + sizeof(le));
+}
+
+std::uint32_t loadLe32(const char* data) {
+    std::uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return from_le32(value);
+}
+
+void appendInsert(std::vector<char>& delta, const char* data, std::size_t size) {
+    if (size == 0) {
+        return;
+    }
+    delta.push_back(static_cast<char>(DELTA_OP_INSERT));
+    appendLe32(delta, static_cast<std::uint32_t>(size));
+    delta.insert(delta.end(), data, data + size);
+}
+
+void appendCopy(std::vector<char>& delta, std::size_t offset, std::size_t size) {
+    delta.push_back(static_cast<char>(DELTA_OP_COPY));
+    appendLe32(delta, static_cast<std::uint32_t>(offset));
+    appendLe32(delta, static_cast<std::uint32_t>(size));
+}
+
+} // namespace
+
+// Base blocks are indexed by their rolling hash, the target is scanned one byte at a time and
+// every block match is extended in both directions as far as the bytes agree.
+bool encodeDelta(const char* base, std::size_t base_size, const char* target,
+                 std::size_t target_size, std::size_t max_delta_size, std::vector<char>& delta) {
+    delta.clear();
+    if (base_size < BLOCK_SIZE || target_size < BLOCK_SIZE ||
+        base_size > UINT32_MAX || target_size > UINT32_MAX) {
+        return false;
+    }
+
+    RollingHash rolling(BLOCK_SIZE);
+    // first base offset of every block hash, keyed by the mixed hash
+    std::unordered_map<std::uint64_t, std::uint32_t> blocks;
+    blocks.reserve(base_size / BLOCK_SIZE);
+    for (std::size_t offset = 0; offset + BLOCK_SIZE <= base_size; offset += BLOCK_SIZE) {
+        blocks.emplace(mixHash(rolling.hash(base + offset)),
+                       static_cast<std::uint32_t>(offset));
+    }
+
+    std::size_t literal_start = 0;
+    std::size_t pos = 0;
+    rolling.reset(target);
+    while (pos + BLOCK_SIZE <= target_size) {
+        const auto it = blocks.find(mixHash(rolling.value()));
+        if (it == blocks.end() || std::memcmp(base + it->second, target + pos, BLOCK_SIZE) != 0) {
+            if (pos + BLOCK_SIZE < target_size) {
+                rolling.roll(target[pos], target[pos + BLOCK_SIZE]);
+            }
+            ++pos;
+            continue;
+        }
+
+        std::size_t base_start = it->second;
+        std::size_t target_start = pos;
+        while (base_start > 0 && target_start > literal_start &&
+               base[base_start - 1] == target[target_start - 1]) {
+            --base_start;
+            --target_start;
+        }
+        std::size_t base_end = it->second + BLOCK_SIZE;
+        std::size_t target_end = pos + BLOCK_SIZE;
+        while (base_end < base_size && target_end < target_size &&
+               base[base_end] == target[target_end]) {
+            ++base_end;
+            ++target_end;
+        }
+
+        appendInsert(delta, target + literal_start, target_start - literal_start);
+        appendCopy(delta, base_start, target_end - target_start);
+        if (delta.size() > max_delta_size) {
+            return false;
+        }
+        literal_start = pos = target_end;
+        if (pos + BLOCK_SIZE <= target_size) {
+            rolling.reset(target + pos);
+        }
+    }
+    appendInsert(delta, target + literal_start, target_size - literal_start);
+    return delta.size() <= max_delta_size;
+}
+
+std::vector<char> applyDelta(const char* base, std::size_t base_size, const char* delta,
+                             std::size_t delta_size, std::size_t target_size) {
+    std::vector<char> target;
+    target.reserve(target_size);
+    std::size_t pos = 0;
+    while (pos < delta_size) {
+        const std::uint8_t op = static_cast<std::uint8_t>(delta[pos++]);
+        if (op == DELTA_OP_COPY) {
+            if (delta_size - pos < 2 * sizeof(std::uint32_t)) {
+                throw std::runtime_error("Delta copy operation is truncated");
+            }
+            const std::uint32_t offset = loadLe32(delta + pos);
+            const std::uint32_t size = loadLe32(delta + pos + sizeof(std::uint32_t));
+            pos += 2 * sizeof(std::uint32_t);
+            if (offset > base_size || size > base_size - offset ||
+                size > target_size - target.size()) {
+                throw std::runtime_error("Delta copy operation is out of bounds");
+            }
+            target.insert(target.end(), base + offset, base + offset + size);
+        } else if (op == DELTA_OP_INSERT) {
+            if (delta_size - pos < sizeof(std::uint32_t)) {
+                throw std::runtime_error("Delta insert operation is truncated");
+            }
+            const std::uint32_t size = loadLe32(delta + pos);
+            pos += sizeof(std::uint32_t);
+            if (size > delta_size - pos || size > target_size - target.size()) {
+                throw std::runtime_error("Delta insert operation is out of bounds");
+            }
+            target.insert(target.end(), delta + pos, delta + pos + size);
+            pos += size;
+        } else {
+            throw std::runtime_error("Unknown delta operation " + std::to_string(op));
+        }
+    }
+    if (target.size() != target_size) {
+        throw std::runtime_error("Delta produces " + std::to_string(target.size()) +
+                                 " bytes instead of " + std::to_string(target_size));
+    }
+    return target;
+}
+
+} // namespace packer
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace packer {
+
+// Binary deltas describing a target buffer as copies from a base buffer and inserted bytes.
+//
+// A delta is a sequence of operations, all integers little-endian:
+// copy:   [1 byte: 0][4 bytes: base offset][4 bytes: length]
+// insert: [1 byte: 1][4 bytes: length][length bytes: data]
+
+// encode `target` against `base` into `delta`; gives up and returns false as soon as the
+// delta would exceed `max_delta_size` bytes
+bool encodeDelta(const char* base, std::size_t base_size, const char* target,
+                 std::size_t target_size, std::size_t max_delta_size, std::vector<char>& delta);
+
+// rebuild the target of `target_size` bytes, throws std::runtime_error on a malformed delta
+std::vector<char> applyDelta(const char* base, std::size_t base_size, const char* delta,
+                             std::size_t delta_size, std::size_t target_size);
+
+} // namespace packer
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "byteorder.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace packer {
+
+namespace detail {
+
+template <typename T> void storeLe(char* out, T value) {
+    static_assert(std::is_unsigned_v<T>, "header fields are unsigned integers");
+    if constexpr (sizeof(T) == 2) {
+        value = to_le16(value);
+    } else if constexpr (sizeof(T) == 4) {
+        value = to_le32(value);
+    } else if constexpr (sizeof(T) == 8) {
+        value = to_le64(value);
+    }
+    std::memcpy(out, &value, sizeof(T));
+}
+
+template <typename T> T loadLe(const char* in) {
+    static_assert(std::is_unsigned_v<T>, "header fields are unsigned integers");
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    if constexpr (sizeof(T) == 2) {
+        return from_le16(value);
+    } else if constexpr (sizeof(T) == 4) {
+        return from_le32(value);
+    } else if constexpr (sizeof(T) == 8) {
+        return from_le64(value);
+    } else {
+        return value;
+    }
+}
+
+} // namespace detail
+
+// Compile-time description of consecutive little-endian fields of an entry header.
+//
+// Field offsets are known at compile time, so encoding and decoding compile down to a few
+// stores and loads on a contiguous buffer instead of one stream call per field.
+template <typename... Fields> struct FieldLayout {
+    static constexpr std::size_t SIZE = (sizeof(Fields) + ... + 0);
+
+    // write all fields to `out`, returns the end of the written bytes
+    static char* encode(char* out, Fields... values) {
+        ((detail::storeLe<Fields>(out, values), out += sizeof(Fields)), ...);
+        return out;
+    }
+
+    static std::tuple<Fields...> decode(const char* in) {
+        return decodeFields(in, std::index_sequence_for<Fields...>{});
+    }
+
+  private:
+    template <std::size_t Index> static constexpr std::size_t offsetOf() {
+        constexpr std::size_t sizes[] = {sizeof(Fields)..., 0};
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < Index; ++i) {
+            offset += sizes[i];
+        }
+        return offset;
+    }
+
+    template <std::size_t... Indices>
+    static std::tuple<Fields...> decodeFields(const char* in, std::index_sequence<Indices...>) {
+        return std::tuple<Fields...>(detail::loadLe<Fields>(in + offsetOf<Indices>())...);
+    }
+};
+
+// [1 byte: file type][2 bytes: entry name length, or depth decrease for leave_directory]
+using EntryPrefixLayout = FieldLayout<std::uint8_t, std::uint16_t>;
+// the second prefix field of leave_directory entries
+using DepthDecreaseLayout = FieldLayout<std::uint16_t>;
+// Fields following the entry name, see Packer for their meaning. Their lengths stay fixed even
+// with a name table: duplicates and delta bases address file data by the offset of its
+// FileDataLayout, which is read back with a single fixed-size read.
+using FileDataLayout = FieldLayout<std::uint32_t, std::uint64_t>; // length, checksum
+using LegacyFileDataLayout = FieldLayout<std::uint32_t>;          // length
+using DuplicateLayout = FieldLayout<std::uint64_t>;               // offset of original data
+using SymlinkLayout = FieldLayout<std::uint16_t>;                 // target length
+using BlobRefLayout = FieldLayout<std::uint64_t, std::uint64_t, std::uint64_t>; // hash, size
+// base data offset, file length, checksum, delta length
+using DeltaLayout = FieldLayout<std::uint64_t, std::uint32_t, std::uint64_t, std::uint32_t>;
+using LegacyDeltaLayout = FieldLayout<std::uint64_t, std::uint32_t, std::uint32_t>;
+
+// Buffer an entry header is assembled in before it is written with a single stream call.
+// Headers up to INLINE_SIZE bytes, i.e. all but those with very long names, stay on the stack.
+class HeaderBuffer {
+  public:
+    static constexpr std::size_t INLINE_SIZE = 512;
+    static constexpr std::size_t MAX_VARINT_SIZE = 10;
+
+    template <typename Layout, typename... Values> void append(Values... values) {
+        Layout::encode(reserve(Layout::SIZE), values...);
+    }
+
+    // unsigned LEB128: 7 bits per byte, least significant first, high bit set on all but the last
+    void appendVarint(std::uint64_t value) {
+        std::array<char, MAX_VARINT_SIZE> bytes;
+        std::size_t size = 0;
+        while (value >= 0x80) {
+            bytes[size++] = static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        bytes[size++] = static_cast<char>(value);
+        appendBytes(std::string_view(bytes.data(), size));
+    }
+
+    void appendBytes(std::string_view bytes) {
+        if (!bytes.empty()) {
+            std::memcpy(reserve(bytes.size()), bytes.data(), bytes.size());
+        }
+    }
+
+    const char* data() const { return heap_.empty() ? inline_.data() : heap_.data(); }
+    std::size_t size() const { return size_; }
+
+    void writeTo(std::ostream& out) const {
+        out.write(data(), static_cast<std::streamsize>(size_));
+    }
+
+  private:
+    char* reserve(std::size_t size) {
+        const std::size_t offset = size_;
+        size_ += size;
+        if (size_ <= INLINE_SIZE) {
+            return inline_.data() + offset;
+        }
+        if (heap_.empty()) {
+            heap_.assign(inline_.data(), inline_.data() + offset);
+        }
+        heap_.resize(size_);
+        return heap_.data() + offset;
+    }
+
+    std::array<char, INLINE_SIZE> inline_;
+    std::vector<char> heap_;
+    std::size_t size_ = 0;
+};
+
+} // namespace packer
@@ -0,0 +1,137 @@
+#include "filelistinputtree.h"
+
+#include "ifstream_exc.h"
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace packer {
+
+namespace {
+
+// true if `path` lies somewhere below `directory`
+bool isBelow(const fs::path& path, const fs::path& directory) {
+    auto path_it = path.begin();
+    for (auto dir_it = directory.begin(); dir_it != directory.end(); ++dir_it, ++path_it) {
+        if (path_it == path.end() || *path_it != *dir_it) {
+            return false;
+        }
+    }
+    return path_it != path.end();
+}
+
+} // namespace
+
+FileListInputTree::FileListInputTree(fs::path root, std::vector<fs::path> paths)
+    : root_(std::move(root)) {
+    paths_.reserve(paths.size());
+    for (fs::path& path : paths) {
+        fs::path normal = path.lexically_normal();
+        // a trailing separator ("dir/") names the same entry as the path without it
+        if (!normal.empty() && !normal.has_filename()) {
+            normal = normal.parent_path();
+        }
+        if (normal.empty() || normal == ".") {
+            continue;
+        }
+        if (normal.is_absolute() || *normal.begin() == "..") {
+            throw std::runtime_error("Path in file list is not below the root: " + path.string());
+        }
+        paths_.push_back(std::move(normal));
+    }
+    // component-wise order keeps the content of every directory contiguous and after it
+    std::sort(paths_.begin(), paths_.end());
+    paths_.erase(std::unique(paths_.begin(), paths_.end()), paths_.end());
+}
+
+std::vector<fs::path> FileListInputTree::readList(std::istream& list) {
+    std::vector<fs::path> paths;
+    std::string path;
+    while (std::getline(list, path, '\0')) {
+        if (!path.empty()) {
+            paths.emplace_back(std::move(path));
+        }
+        path.clear();
+    }
+    if (list.bad()) {
+        throw std::runtime_error("Failed to read file list");
+    }
+    return paths;
+}
+
+// Directories are entered as the sorted paths descend into them and left as soon as a path lies
+// outside of them, so each directory is visited exactly once, right before its content.
+void FileListInputTree::traverse(const Visitor& visit) {
+    // directories entered so far, from the top level down; each is the parent of the next
+    std::vector<fs::path> open_directories;
+    // directory that was not packed, everything listed below it is skipped
+    fs::path skipped_directory;
+
+    for (const fs::path& path : paths_) {
+        if (!skipped_directory.empty() && isBelow(path, skipped_directory)) {
+            continue;
+        }
+        skipped_directory.clear();
+        while (!open_directories.empty() && !isBelow(path, open_directories.back())) {
+            open_directories.pop_back();
+        }
+
+        // synthesize the parent directories not entered yet
+        const fs::path parent = path.parent_path();
+        auto component = parent.begin();
+        std::advance(component, open_directories.size());
+        for (; component != parent.end(); ++component) {
+            fs::path directory =
+                open_directories.empty() ? *component : open_directories.back() / *component;
+            if (entryType(directory) != file_type::directory) {
+                std::cerr << "Error packing entry " << directory << ": not a directory"
+                          << std::endl;
+                skipped_directory = std::move(directory);
+                break;
+            }
+            if (!visit({directory, file_type::directory,
+                        static_cast<int>(open_directories.size())})) {
+                skipped_directory = std::move(directory);
+                break;
+            }
+            open_directories.push_back(std::move(directory));
+        }
+        if (!skipped_directory.empty()) {
+            continue;
+        }
+
+        const InputEntry entry{path, entryType(path), static_cast<int>(open_directories.size())};
+        if (visit(entry) && entry.type == file_type::directory) {
+            open_directories.push_back(path);
+        } else if (entry.type == file_type::directory) {
+            skipped_directory = path;
+        }
+    }
+}
+
+file_type FileListInputTree::entryType(const fs::path& path) const {
+    std::error_code error;
+    return from_std_fs_type(fs::symlink_status(root_ / path, error).type());
+}
+
+std::uint64_t FileListInputTree::fileSize(const fs::path& path) const {
+    return fs::file_size(root_ / path);
+}
+
+std::unique_ptr<std::istream> FileListInputTree::openFile(const fs::path& path) const {
+    auto input_file = std::make_unique<ifstream_exc>(root_ / path, std::ios::binary);
+    if (!input_file->is_open()) {
+        throw std::runtime_error("Failed to open file: " + (root_ / path).string());
+    }
+    return input_file;
+}
+
+fs::path FileListInputTree::readSymlink(const fs::path& path) const {
+    return fs::read_symlink(root_ / path);
+}
+
+} // namespace packer
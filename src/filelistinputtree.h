@@ -0,0 +1,43 @@
+#pragma once
+
+#include "inputtree.h"
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+namespace packer {
+
+// Input tree made of an explicit list of paths below a directory on disk.
+//
+// Only the listed entries are packed, together with the directories leading to them, and no
+// directory is ever read: every listed path and every synthesized parent directory costs a
+// single lstat. A listed directory is packed as an entry without its content unless that
+// content is listed too. Paths are sorted, so the list may come in any order.
+class FileListInputTree : public InputTree {
+  public:
+    // `paths` are relative to `root`; "." entries are ignored, absolute paths and paths leaving
+    // the root throw std::runtime_error
+    FileListInputTree(fs::path root, std::vector<fs::path> paths);
+
+    // read a list of NUL-separated paths, as printed by `find -print0` or `git ls-files -z`;
+    // the last path may or may not be terminated
+    static std::vector<fs::path> readList(std::istream& list);
+
+    void traverse(const Visitor& visit) override;
+
+    std::uint64_t fileSize(const fs::path& path) const override;
+    std::unique_ptr<std::istream> openFile(const fs::path& path) const override;
+    fs::path readSymlink(const fs::path& path) const override;
+
+    std::size_t size() const { return paths_.size(); }
+
+  private:
+    // type of an entry below the root without following symlinks, unknown if it is missing
+    file_type entryType(const fs::path& path) const;
+
+    fs::path root_;
+    // normalized, sorted and without duplicates
+    std::vector<fs::path> paths_;
+};
+
+} // namespace packer
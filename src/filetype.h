@@ -16,6 +16,10 @@ enum class file_type : signed char {
     character = 7,
     fifo = 8,
     socket = 9,
+    // regular file whose data lives in a blob store, see BlobStore
+    blob_ref = 10,
+    // regular file stored as a delta against the file data of an earlier entry
+    delta = 11,
 };
 
 inline file_type from_std_fs_type(const std::filesystem::file_type& ftype) {
@@ -75,6 +79,12 @@ inline std::ostream& operator<<(std::ostream& os, const file_type& ft) {
         case file_type::socket:
             os << "socket";
             break;
+        case file_type::blob_ref:
+            os << "blob_ref";
+            break;
+        case file_type::delta:
+            os << "delta";
+            break;
         default:
             os << "invalid(" << static_cast<int>(ft) << ")";
             break;
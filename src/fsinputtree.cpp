@@ -0,0 +1,93 @@
+#include "fsinputtree.h"
+
+#include "ifstream_exc.h"
+#include "locality.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace packer {
+
+FsInputTree::FsInputTree(fs::path root, bool locality_order)
+    : root_(std::move(root)), locality_order_(locality_order) {}
+
+void FsInputTree::traverse(const Visitor& visit) {
+    if (locality_order_) {
+        traverseByLocality(visit, fs::path(), 0);
+        return;
+    }
+
+    for (auto it = fs::recursive_directory_iterator(root_, fs::directory_options::none);
+         it != fs::recursive_directory_iterator(); ++it) {
+        const fs::directory_entry& entry = *it;
+        const InputEntry input_entry{entry.path().lexically_relative(root_),
+                                     from_std_fs_type(entry.symlink_status().type()), it.depth()};
+        if (!visit(input_entry) && input_entry.type == file_type::directory) {
+            it.disable_recursion_pending();
+        }
+    }
+}
+
+// Visit one directory level: regular files first, ordered by inode number so that reads follow
+// the on-disk layout more closely, then other entries, then subdirectories each followed by
+// their own content. Every entry is still visited while its parent is the current directory,
+// so the directory nesting is the same as for the default traversal.
+void FsInputTree::traverseByLocality(const Visitor& visit, const fs::path& relative_dir,
+                                     int depth) {
+    std::vector<std::pair<std::uint64_t, InputEntry>> files;
+    std::vector<InputEntry> others;
+    std::vector<InputEntry> subdirs;
+    for (const fs::directory_entry& entry : fs::directory_iterator(root_ / relative_dir)) {
+        InputEntry input_entry{relative_dir / entry.path().filename(),
+                               from_std_fs_type(entry.symlink_status().type()), depth};
+        if (input_entry.type == file_type::regular) {
+            files.emplace_back(fileInode(entry.path()), std::move(input_entry));
+        } else if (input_entry.type == file_type::directory) {
+            subdirs.push_back(std::move(input_entry));
+        } else {
+            others.push_back(std::move(input_entry));
+        }
+    }
+    std::sort(files.begin(), files.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    // keep a window of upcoming files in flight and drop consumed ones from the page cache
+    for (std::size_t i = 0; i < std::min(files.size(), LOCALITY_READAHEAD_FILES); ++i) {
+        adviseWillNeed(root_ / files[i].second.path);
+    }
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (i + LOCALITY_READAHEAD_FILES < files.size()) {
+            adviseWillNeed(root_ / files[i + LOCALITY_READAHEAD_FILES].second.path);
+        }
+        visit(files[i].second);
+        adviseDontNeed(root_ / files[i].second.path);
+    }
+
+    for (const InputEntry& entry : others) {
+        visit(entry);
+    }
+    for (const InputEntry& entry : subdirs) {
+        if (visit(entry)) {
+            traverseByLocality(visit, entry.path, depth + 1);
+        }
+    }
+}
+
+std::uint64_t FsInputTree::fileSize(const fs::path& path) const {
+    return fs::file_size(root_ / path);
+}
+
+std::unique_ptr<std::istream> FsInputTree::openFile(const fs::path& path) const {
+    auto input_file = std::make_unique<ifstream_exc>(root_ / path, std::ios::binary);
+    if (!input_file->is_open()) {
+        throw std::runtime_error("Failed to open file: " + (root_ / path).string());
+    }
+    return input_file;
+}
+
+fs::path FsInputTree::readSymlink(const fs::path& path) const {
+    return fs::read_symlink(root_ / path);
+}
+
+} // namespace packer
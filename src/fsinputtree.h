@@ -0,0 +1,33 @@
+#pragma once
+
+#include "inputtree.h"
+#include <cstddef>
+
+namespace packer {
+
+// Input tree reading a directory from the filesystem
+class FsInputTree : public InputTree {
+  public:
+    // With `locality_order` each directory's regular files are visited in inode order and the
+    // kernel is given readahead hints (useful on rotational disks where directory order is
+    // effectively random on disk). Otherwise entries are visited in directory order.
+    explicit FsInputTree(fs::path root, bool locality_order = false);
+
+    void traverse(const Visitor& visit) override;
+
+    std::uint64_t fileSize(const fs::path& path) const override;
+    std::unique_ptr<std::istream> openFile(const fs::path& path) const override;
+    fs::path readSymlink(const fs::path& path) const override;
+
+  private:
+    // number of upcoming files to request readahead for in locality order
+    static constexpr std::size_t LOCALITY_READAHEAD_FILES = 8;
+
+    // visit a directory recursively in locality order
+    void traverseByLocality(const Visitor& visit, const fs::path& relative_dir, int depth);
+
+    fs::path root_;
+    bool locality_order_;
+};
+
+} // namespace packer
@@ -0,0 +1,280 @@
+#include "fsoutputtree.h"
+
+#include "ifstream_exc.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace packer {
+
+namespace {
+
+std::system_error systemError(const std::string& what, const fs::path& path) {
+    return std::system_error(errno, std::generic_category(), what + " " + path.string());
+}
+
+// closes a file descriptor when going out of scope unless it was closed explicitly
+class FileDescriptor {
+  public:
+    explicit FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return fd_; }
+    // close reporting the error, which may be the first sign of a failed delayed write
+    int close() { return ::close(std::exchange(fd_, -1)); }
+
+  private:
+    int fd_;
+};
+
+void writeAll(int fd, const char* data, std::size_t size, std::uint64_t offset,
+              const fs::path& path) {
+    while (size > 0) {
+        const ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw systemError("Failed to write", path);
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+        offset += static_cast<std::uint64_t>(written);
+    }
+}
+
+// attempts at finding an unused temporary name before giving up
+constexpr int TEMPORARY_NAME_ATTEMPTS = 16;
+
+// Candidate name for a temporary entry next to `out_path`. The random suffix keeps it from
+// colliding with archived entries and with leftovers of interrupted runs; callers still create it
+// exclusively and retry with another name if it exists.
+fs::path temporaryPath(const fs::path& out_path) {
+    thread_local std::mt19937_64 random{std::random_device{}()};
+    char suffix[17];
+    std::snprintf(suffix, sizeof(suffix), "%016llx", static_cast<unsigned long long>(random()));
+    return out_path.parent_path() / ("." + out_path.filename().string() + ".packer-" + suffix);
+}
+
+// rename() atomically replaces any non-directory, a directory in the way of an entry that
+// changed its type is removed first
+void removeDirectoryInTheWay(const fs::path& path) {
+    std::error_code ec;
+    if (fs::is_directory(fs::symlink_status(path, ec))) {
+        fs::remove_all(path);
+    }
+}
+
+} // namespace
+
+FsOutputTree::FsOutputTree(fs::path root, sync_mode sync, std::size_t write_chunk_size,
+                           BufferPool* buffers)
+    : root_(std::move(root)), sync_(sync),
+      write_chunk_size_(std::max<std::size_t>(write_chunk_size, 1)),
+      buffers_(buffers != nullptr ? *buffers : own_buffers_) {}
+
+void FsOutputTree::createDirectory(const fs::path& path) {
+    fs::create_directories(root_ / path);
+}
+
+void FsOutputTree::writeFile(const fs::path& path, std::istream& data, std::uint64_t size) {
+    const fs::path out_path = root_ / path;
+    FileDescriptor fd(::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (fd.get() < 0) {
+        throw systemError("Failed to create", out_path);
+    }
+    writeContent(fd.get(), out_path, data, size);
+    if (fd.close() != 0) {
+        throw systemError("Failed to close", out_path);
+    }
+}
+
+void FsOutputTree::writeContent(int fd, const fs::path& out_path, std::istream& data,
+                                std::uint64_t size) {
+#ifdef __linux__
+    // reserve all blocks up front; filesystems without support simply skip it
+    if (size > 0 && ::fallocate(fd, 0, 0, static_cast<off_t>(size)) != 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        throw systemError("Failed to preallocate", out_path);
+    }
+#endif
+
+    const BufferPool::Buffer buffer = buffers_.acquire(write_chunk_size_);
+    std::uint64_t offset = 0;
+    while (offset < size) {
+        const std::size_t to_read =
+            static_cast<std::size_t>(std::min<std::uint64_t>(size - offset, buffer.size()));
+        data.read(buffer.data(), static_cast<std::streamsize>(to_read));
+        if (static_cast<std::size_t>(data.gcount()) != to_read) {
+            throw std::runtime_error("Unexpected EOF while extracting file: " + out_path.string());
+        }
+        writeAll(fd, buffer.data(), to_read, offset, out_path);
+#ifdef __linux__
+        if (sync_ == sync_mode::batch) {
+            // start writeback of this chunk without waiting for it (write-behind)
+            ::sync_file_range(fd, static_cast<off_t>(offset), static_cast<off_t>(to_read),
+                              SYNC_FILE_RANGE_WRITE);
+        }
+#endif
+        offset += to_read;
+    }
+}
+
+void FsOutputTree::createSymlink(const fs::path& path, const fs::path& target) {
+    const fs::path link_path = root_ / path;
+    std::error_code ec;
+    fs::create_symlink(target, link_path, ec);
+    if (ec) {
+        // try directory-symlink as fallback (platform dependent)
+        fs::create_directory_symlink(target, link_path, ec);
+        if (ec) {
+            throw std::runtime_error("Failed to create symlink \"" + link_path.string() +
+                                     "\" to \"" + target.string() + "\": " + ec.message());
+        }
+    }
+}
+
+std::optional<std::uint64_t> FsOutputTree::existingFileSize(const fs::path& path) const {
+    std::error_code ec;
+    if (!fs::is_regular_file(fs::symlink_status(root_ / path, ec))) {
+        return std::nullopt;
+    }
+    return fs::file_size(root_ / path);
+}
+
+std::unique_ptr<std::istream> FsOutputTree::openExistingFile(const fs::path& path) const {
+    auto file = std::make_unique<ifstream_exc>(root_ / path, std::ios::binary);
+    if (!file->is_open()) {
+        throw std::runtime_error("Failed to open file: " + (root_ / path).string());
+    }
+    return file;
+}
+
+std::optional<fs::path> FsOutputTree::existingSymlinkTarget(const fs::path& path) const {
+    std::error_code ec;
+    if (!fs::is_symlink(fs::symlink_status(root_ / path, ec))) {
+        return std::nullopt;
+    }
+    return fs::read_symlink(root_ / path);
+}
+
+std::vector<std::string> FsOutputTree::listDirectory(const fs::path& path) const {
+    std::vector<std::string> names;
+    std::error_code ec;
+    // a symlink to a directory is an entry of its own, its target is never listed
+    if (!fs::is_directory(fs::symlink_status(root_ / path, ec))) {
+        return names;
+    }
+    for (const fs::directory_entry& entry : fs::directory_iterator(root_ / path)) {
+        names.push_back(entry.path().filename().string());
+    }
+    return names;
+}
+
+void FsOutputTree::replaceFile(const fs::path& path, std::istream& data, std::uint64_t size) {
+    const fs::path out_path = root_ / path;
+    fs::path tmp_path;
+    int raw_fd = -1;
+    for (int attempt = 0; raw_fd < 0; ++attempt) {
+        tmp_path = temporaryPath(out_path);
+        raw_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (raw_fd < 0 && (errno != EEXIST || attempt + 1 == TEMPORARY_NAME_ATTEMPTS)) {
+            throw systemError("Failed to create", tmp_path);
+        }
+    }
+    FileDescriptor fd(raw_fd);
+    try {
+        writeContent(fd.get(), tmp_path, data, size);
+        if (fd.close() != 0) {
+            throw systemError("Failed to close", tmp_path);
+        }
+        removeDirectoryInTheWay(out_path);
+        fs::rename(tmp_path, out_path);
+    } catch (...) {
+        std::error_code ec;
+        fs::remove(tmp_path, ec);
+        throw;
+    }
+}
+
+void FsOutputTree::replaceSymlink(const fs::path& path, const fs::path& target) {
+    const fs::path link_path = root_ / path;
+    fs::path tmp_path;
+    std::error_code ec;
+    for (int attempt = 0; attempt < TEMPORARY_NAME_ATTEMPTS; ++attempt) {
+        tmp_path = temporaryPath(link_path);
+        fs::create_symlink(target, tmp_path, ec);
+        if (ec != std::errc::file_exists) {
+            break;
+        }
+    }
+    if (!ec) {
+        removeDirectoryInTheWay(link_path);
+        fs::rename(tmp_path, link_path, ec);
+    }
+    if (ec) {
+        std::error_code ignored;
+        fs::remove(tmp_path, ignored);
+        throw std::runtime_error("Failed to replace symlink \"" + link_path.string() +
+                                 "\" to \"" + target.string() + "\": " + ec.message());
+    }
+}
+
+// Existing entries of another type on the way, e.g. a file that became a directory between two
+// releases, are replaced. Symlinks are not followed, so a symlink is replaced as well.
+void FsOutputTree::replaceDirectory(const fs::path& path) {
+    std::error_code ec;
+    if (fs::is_directory(fs::symlink_status(root_ / path, ec))) {
+        return;
+    }
+    fs::path current = root_;
+    for (const fs::path& component : path) {
+        current /= component;
+        const fs::file_status status = fs::symlink_status(current, ec);
+        if (fs::is_directory(status)) {
+            continue;
+        }
+        if (fs::exists(status)) {
+            fs::remove_all(current);
+        }
+        fs::create_directory(current);
+    }
+}
+
+void FsOutputTree::removeEntry(const fs::path& path) {
+    fs::remove_all(root_ / path);
+}
+
+void FsOutputTree::finish() {
+    if (sync_ == sync_mode::none) {
+        return;
+    }
+    FileDescriptor fd(::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd.get() < 0) {
+        throw systemError("Failed to open", root_);
+    }
+#ifdef __linux__
+    const int result = ::syncfs(fd.get());
+#else
+    ::sync(); // no per-filesystem sync available, flush everything
+    const int result = 0;
+#endif
+    if (result != 0) {
+        throw systemError("Failed to sync", root_);
+    }
+}
+
+} // namespace packer
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "bufferpool.h"
+#include "outputtree.h"
+#include <cstddef>
+
+namespace packer {
+
+// how extracted data is made durable
+enum class sync_mode {
+    // leave writeback to the kernel
+    none,
+    // flush the whole output filesystem once all entries are extracted
+    end,
+    // start writeback of file data while extracting and flush the filesystem at the end
+    batch,
+};
+
+// Output tree writing into an existing directory on the filesystem.
+//
+// Every file is preallocated to its final size before its data is written with large positioned
+// writes, which keeps large restores from fragmenting. Durability is controlled by the sync mode;
+// instead of an fsync per file a single syncfs covers the whole output at the end.
+class FsOutputTree : public OutputTree {
+  public:
+    static constexpr std::size_t DEFAULT_WRITE_CHUNK_SIZE = 1024 * 1024;
+
+    // file data is copied in chunks of `write_chunk_size` bytes, see IoTuning::write_chunk_size,
+    // taken from `buffers` (e.g. the pool of the unpacking Packer) or from a pool of the tree
+    explicit FsOutputTree(fs::path root, sync_mode sync = sync_mode::none,
+                          std::size_t write_chunk_size = DEFAULT_WRITE_CHUNK_SIZE,
+                          BufferPool* buffers = nullptr);
+
+    void createDirectory(const fs::path& path) override;
+    void writeFile(const fs::path& path, std::istream& data, std::uint64_t size) override;
+    void createSymlink(const fs::path& path, const fs::path& target) override;
+    void finish() override;
+
+    std::optional<std::uint64_t> existingFileSize(const fs::path& path) const override;
+    std::unique_ptr<std::istream> openExistingFile(const fs::path& path) const override;
+    std::optional<fs::path> existingSymlinkTarget(const fs::path& path) const override;
+    std::vector<std::string> listDirectory(const fs::path& path) const override;
+    // written under a new temporary name in the same directory, then renamed over the old entry;
+    // an existing entry of another type is removed
+    void replaceFile(const fs::path& path, std::istream& data, std::uint64_t size) override;
+    void replaceSymlink(const fs::path& path, const fs::path& target) override;
+    void replaceDirectory(const fs::path& path) override;
+    void removeEntry(const fs::path& path) override;
+
+  private:
+    // write `size` bytes of `data` into the open file `fd` created at `out_path`
+    void writeContent(int fd, const fs::path& out_path, std::istream& data, std::uint64_t size);
+
+    fs::path root_;
+    sync_mode sync_;
+    std::size_t write_chunk_size_;
+    BufferPool own_buffers_;
+    BufferPool& buffers_;
+};
+
+} // namespace packer
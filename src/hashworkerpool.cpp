@@ -0,0 +1,146 @@
+#include "hashworkerpool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace packer {
+
+HashWorkerPool::HashWorkerPool(const StreamHasher& hasher, std::size_t thread_count,
+                               std::size_t max_bytes_in_flight)
+    : hasher_(hasher), max_bytes_in_flight_(max_bytes_in_flight) {
+    thread_count = std::max<std::size_t>(thread_count, 1);
+    workers_.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back(&HashWorkerPool::run, this);
+    }
+}
+
+HashWorkerPool::~HashWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    job_available_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void HashWorkerPool::submit(std::streamoff offset, StreamHasher::hash_value_t expected_hash,
+                            std::vector<char> data) {
+    const StreamId stream = beginStream(offset, expected_hash);
+    submitChunk(stream, std::move(data));
+    endStream(stream);
+}
+
+HashWorkerPool::StreamId HashWorkerPool::beginStream(std::streamoff offset,
+                                                     StreamHasher::hash_value_t expected_hash) {
+    std::unique_ptr<StreamHasher::State> state = hasher_.start();
+    std::lock_guard<std::mutex> lock(mutex_);
+    const StreamId id = next_stream_++;
+    Stream& stream = streams_[id];
+    stream.offset = offset;
+    stream.expected_hash = expected_hash;
+    stream.state = std::move(state);
+    return id;
+}
+
+void HashWorkerPool::submitChunk(StreamId stream, std::vector<char> data) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // a chunk larger than the limit is still accepted once the queue has drained
+    space_available_.wait(lock, [&] {
+        return bytes_in_flight_ == 0 || bytes_in_flight_ + data.size() <= max_bytes_in_flight_;
+    });
+    enqueue(lock, stream, std::move(data));
+}
+
+void HashWorkerPool::enqueue(std::unique_lock<std::mutex>& lock, StreamId id,
+                             std::vector<char> data) {
+    Stream& stream = streams_.at(id);
+    bytes_in_flight_ += data.size();
+    const bool became_ready = stream.chunks.empty() && !stream.busy;
+    stream.chunks.push_back(std::move(data));
+    if (became_ready) {
+        ready_.push_back(id);
+        lock.unlock();
+        job_available_.notify_one();
+    }
+}
+
+void HashWorkerPool::endStream(StreamId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stream& stream = streams_.at(id);
+    stream.ended = true;
+    if (stream.chunks.empty() && !stream.busy) {
+        complete(id, stream);
+    }
+}
+
+void HashWorkerPool::cancelStream(StreamId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stream& stream = streams_.at(id);
+    for (const std::vector<char>& chunk : stream.chunks) {
+        bytes_in_flight_ -= chunk.size();
+    }
+    stream.chunks.clear();
+    stream.ended = true;
+    stream.cancelled = true;
+    if (!stream.busy) {
+        // a stream queued as ready is skipped by the workers once it is gone
+        complete(id, stream);
+    }
+}
+
+void HashWorkerPool::complete(StreamId id, Stream& stream) {
+    if (!stream.cancelled && stream.state->digest() != stream.expected_hash) {
+        mismatches_.push_back(stream.offset);
+    }
+    streams_.erase(id);
+    space_available_.notify_all();
+}
+
+std::vector<std::streamoff> HashWorkerPool::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_available_.wait(lock, [&] { return streams_.empty(); });
+    std::vector<std::streamoff> mismatches = std::move(mismatches_);
+    mismatches_.clear();
+    std::sort(mismatches.begin(), mismatches.end());
+    return mismatches;
+}
+
+void HashWorkerPool::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        job_available_.wait(lock, [&] { return stopping_ || !ready_.empty(); });
+        if (ready_.empty()) {
+            return; // stopping and nothing left to do
+        }
+        const StreamId id = ready_.front();
+        ready_.pop_front();
+        const auto it = streams_.find(id);
+        if (it == streams_.end() || it->second.chunks.empty()) {
+            continue; // cancelled meanwhile
+        }
+        Stream& stream = it->second;
+        std::vector<char> chunk = std::move(stream.chunks.front());
+        stream.chunks.pop_front();
+        stream.busy = true;
+        lock.unlock();
+
+        // only this worker touches the state until the stream is no longer busy
+        stream.state->update(chunk.data(), chunk.size());
+
+        lock.lock();
+        stream.busy = false;
+        bytes_in_flight_ -= chunk.size();
+        if (!stream.chunks.empty()) {
+            ready_.push_back(id);
+            job_available_.notify_one();
+        } else if (stream.ended) {
+            complete(id, stream);
+        }
+        space_available_.notify_all();
+    }
+}
+
+} // namespace packer
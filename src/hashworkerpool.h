@@ -0,0 +1,86 @@
+#pragma once
+
+#include "streamhasher.h"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace packer {
+
+// Pool of worker threads checking payload buffers against their expected hash values.
+// The producer keeps reading while the workers hash; the amount of queued payload bytes
+// is bounded so that memory use stays flat regardless of the archive size.
+//
+// Payloads too large to hold in memory are handed over as streams of chunks. The chunks of a
+// stream are hashed in order, by one worker at a time, into a hash state of the stream, while
+// other workers hash other payloads; the producer never hashes itself.
+class HashWorkerPool {
+  public:
+    using StreamId = std::size_t;
+
+    HashWorkerPool(const StreamHasher& hasher, std::size_t thread_count,
+                   std::size_t max_bytes_in_flight);
+    ~HashWorkerPool();
+
+    HashWorkerPool(const HashWorkerPool&) = delete;
+    HashWorkerPool& operator=(const HashWorkerPool&) = delete;
+
+    // queue a payload for checking, blocks while too many bytes are already queued
+    void submit(std::streamoff offset, StreamHasher::hash_value_t expected_hash,
+                std::vector<char> data);
+
+    // start a payload handed over in chunks
+    StreamId beginStream(std::streamoff offset, StreamHasher::hash_value_t expected_hash);
+    // queue the next chunk of a stream, blocks while too many bytes are already queued
+    void submitChunk(StreamId stream, std::vector<char> data);
+    // no more chunks follow, the payload is checked once the queued ones are hashed
+    void endStream(StreamId stream);
+    // drop a stream whose payload could not be read completely, without a verdict
+    void cancelStream(StreamId stream);
+
+    // wait until all queued payloads are checked and return offsets of the mismatching ones;
+    // every stream has to be ended or cancelled before
+    std::vector<std::streamoff> finish();
+
+  private:
+    struct Stream {
+        std::streamoff offset = 0;
+        StreamHasher::hash_value_t expected_hash = 0;
+        std::unique_ptr<StreamHasher::State> state;
+        std::deque<std::vector<char>> chunks;
+        // no more chunks are added
+        bool ended = false;
+        bool cancelled = false;
+        // a worker is hashing a chunk of the stream
+        bool busy = false;
+    };
+
+    void run();
+    // queue a chunk with the lock held
+    void enqueue(std::unique_lock<std::mutex>& lock, StreamId id, std::vector<char> data);
+    // record the verdict of an ended stream without queued chunks and forget it
+    void complete(StreamId id, Stream& stream);
+
+    const StreamHasher& hasher_;
+    const std::size_t max_bytes_in_flight_;
+
+    std::mutex mutex_;
+    std::condition_variable job_available_;
+    std::condition_variable space_available_;
+    std::unordered_map<StreamId, Stream> streams_;
+    // streams with queued chunks which no worker is hashing, in the order they became ready
+    std::deque<StreamId> ready_;
+    StreamId next_stream_ = 0;
+    std::size_t bytes_in_flight_ = 0;
+    bool stopping_ = false;
+    std::vector<std::streamoff> mismatches_;
+    std::vector<std::thread> workers_;
+};
+
+} // namespace packer
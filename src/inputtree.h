@@ -0,0 +1,44 @@
+#pragma once
+
+#include "filetype.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <memory>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// an entry of an input tree as seen by Packer::pack
+struct InputEntry {
+    // path relative to the root of the tree
+    fs::path path;
+    file_type type = file_type::unknown;
+    // number of directories between the root and the entry, 0 for top level entries
+    int depth = 0;
+};
+
+// Source of the entries packed into an archive (e.g. a directory on disk or an in-memory tree)
+class InputTree {
+  public:
+    // called for each entry, returns false if the entry was not packed; the content of a
+    // directory that was not packed is not visited
+    using Visitor = std::function<bool(const InputEntry& entry)>;
+
+    virtual ~InputTree() = default;
+
+    // Visit all entries below the root. Every entry must be visited after its parent directory
+    // and before any entry outside of that directory.
+    virtual void traverse(const Visitor& visit) = 0;
+
+    // size of a regular file
+    virtual std::uint64_t fileSize(const fs::path& path) const = 0;
+    // open a regular file for reading, throws std::runtime_error on failure
+    virtual std::unique_ptr<std::istream> openFile(const fs::path& path) const = 0;
+    // target of a symbolic link
+    virtual fs::path readSymlink(const fs::path& path) const = 0;
+};
+
+} // namespace packer
@@ -0,0 +1,266 @@
+#include "iotuning.h"
+
+#include "bufferpool.h"
+#include "ifstream_exc.h"
+#include "locality.h"
+#include "xxhasher.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace packer {
+
+namespace {
+
+constexpr std::array<std::size_t, 7> CALIBRATION_CHUNK_SIZES = {
+    8 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024};
+// passes per chunk size, a single pass is too noisy to compare sizes by
+constexpr std::size_t CALIBRATION_RUNS = 3;
+
+std::system_error systemError(const std::string& what, const fs::path& path) {
+    return std::system_error(errno, std::generic_category(), what + " " + path.string());
+}
+
+// closes a file descriptor when going out of scope
+class FileDescriptor {
+  public:
+    explicit FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return fd_; }
+
+  private:
+    int fd_;
+};
+
+// wait until the data written to `fd` reached the storage
+void syncData(int fd, const fs::path& path) {
+#ifdef __linux__
+    const int result = ::fdatasync(fd);
+#else
+    const int result = ::fsync(fd);
+#endif
+    if (result != 0) {
+        throw systemError("Failed to sync", path);
+    }
+}
+
+std::size_t parseChunkSize(const std::string& name, const std::string& value) {
+    std::size_t parsed = 0;
+    std::size_t size = 0;
+    try {
+        size = std::stoull(value, &parsed);
+    } catch (const std::logic_error&) {
+        parsed = 0;
+    }
+    if (parsed == 0 || parsed != value.size()) {
+        throw std::runtime_error("Invalid value for " + name + " in tuning file: " + value);
+    }
+    if (size < IoTuning::MIN_CHUNK_SIZE || size > IoTuning::MAX_CHUNK_SIZE) {
+        throw std::runtime_error("Chunk size out of range for " + name + ": " + value);
+    }
+    return size;
+}
+
+// seconds taken by `run`
+double measure(const std::function<void()>& run) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// fastest chunk size for one kind of I/O by the median time of its passes, reporting the
+// throughput of every candidate
+std::size_t fastestChunkSize(const char* name, std::uint64_t sample_size, std::ostream& report,
+                             const std::function<void(std::size_t)>& run) {
+    std::size_t best_size = 0;
+    double best_seconds = 0;
+    for (const std::size_t chunk_size : CALIBRATION_CHUNK_SIZES) {
+        std::array<double, CALIBRATION_RUNS> passes{};
+        for (double& pass : passes) {
+            pass = measure([&] { run(chunk_size); });
+        }
+        std::nth_element(passes.begin(), passes.begin() + CALIBRATION_RUNS / 2, passes.end());
+        const double seconds = passes[CALIBRATION_RUNS / 2];
+        report << name << " chunk " << chunk_size << ": "
+               << static_cast<double>(sample_size) / (1024 * 1024) / std::max(seconds, 1e-9)
+               << " MiB/s" << std::endl;
+        if (best_size == 0 || seconds < best_seconds) {
+            best_size = chunk_size;
+            best_seconds = seconds;
+        }
+    }
+    return best_size;
+}
+
+} // namespace
+
+fs::path defaultIoTuningPath() {
+    if (const char* file = std::getenv("PACKER_TUNING_FILE"); file != nullptr && *file != '\0') {
+        return fs::path(file);
+    }
+    if (const char* config = std::getenv("XDG_CONFIG_HOME"); config != nullptr && *config != '\0') {
+        return fs::path(config) / "packer" / "io_tuning";
+    }
+    if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return fs::path(home) / ".config" / "packer" / "io_tuning";
+    }
+    return fs::path();
+}
+
+IoTuning loadIoTuning(const fs::path& path) {
+    IoTuning tuning;
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        if (fs::exists(path)) {
+            throw std::runtime_error("Failed to open tuning file: " + path.string());
+        }
+        return tuning;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const std::size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            throw std::runtime_error("Malformed line in tuning file " + path.string() + ": " +
+                                     line);
+        }
+        const std::string name = line.substr(0, separator);
+        const std::string value = line.substr(separator + 1);
+        if (name == "read_chunk_size") {
+            tuning.read_chunk_size = parseChunkSize(name, value);
+        } else if (name == "hash_chunk_size") {
+            tuning.hash_chunk_size = parseChunkSize(name, value);
+        } else if (name == "write_chunk_size") {
+            tuning.write_chunk_size = parseChunkSize(name, value);
+        } else {
+            throw std::runtime_error("Unknown setting in tuning file " + path.string() + ": " +
+                                     name);
+        }
+    }
+    return tuning;
+}
+
+void saveIoTuning(const IoTuning& tuning, const fs::path& path) {
+    if (path.has_parent_path()) {
+        fs::create_directories(path.parent_path());
+    }
+    fs::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream out;
+        out.exceptions(std::ios::failbit | std::ios::badbit);
+        out.open(tmp_path);
+        out << "# written by packer calibrate\n"
+            << "read_chunk_size=" << tuning.read_chunk_size << '\n'
+            << "hash_chunk_size=" << tuning.hash_chunk_size << '\n'
+            << "write_chunk_size=" << tuning.write_chunk_size << '\n';
+    }
+    fs::rename(tmp_path, path);
+}
+
+IoTuning calibrateIoTuning(const fs::path& scratch_dir, std::uint64_t sample_size,
+                           std::ostream& report) {
+    if (sample_size == 0) {
+        throw std::runtime_error("Calibration needs a non-empty sample");
+    }
+    const fs::path sample_path = scratch_dir / "packer-calibration.tmp";
+    BufferPool buffers;
+    IoTuning tuning;
+
+    // the sample is removed however calibration ends
+    struct SampleRemover {
+        const fs::path& path;
+        ~SampleRemover() {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    } remover{sample_path};
+
+    auto writeSample = [&](std::size_t chunk_size) {
+        BufferPool::Buffer buffer = buffers.acquire(chunk_size);
+        for (std::size_t i = 0; i < chunk_size; ++i) {
+            buffer.data()[i] = static_cast<char>(i * 31 + (i >> 12));
+        }
+        FileDescriptor fd(
+            ::open(sample_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+        if (fd.get() < 0) {
+            throw systemError("Failed to create", sample_path);
+        }
+        for (std::uint64_t written = 0; written < sample_size;) {
+            const auto to_write = static_cast<std::size_t>(
+                std::min<std::uint64_t>(sample_size - written, chunk_size));
+            const ssize_t result = ::write(fd.get(), buffer.data(), to_write);
+            if (result < 0 && errno != EINTR) {
+                throw systemError("Failed to write", sample_path);
+            }
+            written += static_cast<std::uint64_t>(std::max<ssize_t>(result, 0));
+        }
+        // handing the data to the page cache only measures memcpy, wait for the storage
+        syncData(fd.get(), sample_path);
+    };
+    tuning.write_chunk_size = fastestChunkSize("write", sample_size, report, writeSample);
+
+    auto readSample = [&](std::size_t chunk_size) {
+        {
+            // dirty pages cannot be dropped, make sure none are left
+            FileDescriptor fd(::open(sample_path.c_str(), O_RDONLY | O_CLOEXEC));
+            if (fd.get() < 0) {
+                throw systemError("Failed to open", sample_path);
+            }
+            syncData(fd.get(), sample_path);
+        }
+        adviseDontNeed(sample_path);
+        BufferPool::Buffer buffer = buffers.acquire(chunk_size);
+        // unbuffered, so every read is a read(2) of `chunk_size` bytes; the buffer has to be
+        // set before the file is opened to take effect
+        ifstream_exc in;
+        in.rdbuf()->pubsetbuf(nullptr, 0);
+        in.open(sample_path, std::ios::binary);
+        if (!in.is_open()) {
+            throw systemError("Failed to open", sample_path);
+        }
+        while (in.read(buffer.data(), static_cast<std::streamsize>(chunk_size))) {
+        }
+    };
+    tuning.read_chunk_size = fastestChunkSize("read", sample_size, report, readSample);
+
+    // hashed the way Packer hashes streams, through a pooled buffer fed to the hasher's state
+    const XXHasher hasher;
+    auto hashSample = [&](std::size_t chunk_size) {
+        BufferPool::Buffer buffer = buffers.acquire(chunk_size);
+        const std::unique_ptr<StreamHasher::State> state = hasher.start();
+        ifstream_exc in(sample_path, std::ios::binary);
+        while (in.read(buffer.data(), static_cast<std::streamsize>(chunk_size)) ||
+               in.gcount() > 0) {
+            state->update(buffer.data(), static_cast<std::size_t>(in.gcount()));
+        }
+        state->digest();
+    };
+    // warm the page cache once so that hashing is measured rather than the storage
+    hashSample(tuning.read_chunk_size);
+    tuning.hash_chunk_size = fastestChunkSize("hash", sample_size, report, hashSample);
+
+    return tuning;
+}
+
+} // namespace packer
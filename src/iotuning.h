@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// Chunk sizes of the I/O loops, adjustable at runtime and measured by calibrateIoTuning.
+struct IoTuning {
+    static constexpr std::size_t MIN_CHUNK_SIZE = 4 * 1024;
+    static constexpr std::size_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+
+    // reading input files when comparing them and copying their data into an archive
+    std::size_t read_chunk_size = 64 * 1024;
+    // reading streams that are hashed and blob store keys are computed from
+    std::size_t hash_chunk_size = 8 * 1024;
+    // writing extracted files, see FsOutputTree
+    std::size_t write_chunk_size = 1024 * 1024;
+};
+
+// Tuning file used when none is given explicitly: $PACKER_TUNING_FILE if set, otherwise
+// packer/io_tuning in $XDG_CONFIG_HOME or ~/.config; empty if neither can be determined.
+fs::path defaultIoTuningPath();
+
+// Read a tuning file of "name=value" lines. Sizes missing from the file keep their defaults,
+// a file that does not exist yields the defaults. Throws std::runtime_error on malformed
+// lines and on sizes outside [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE].
+IoTuning loadIoTuning(const fs::path& path);
+// write a tuning file, creating its parent directories and replacing an existing file atomically
+void saveIoTuning(const IoTuning& tuning, const fs::path& path);
+
+// Measure read, hash and write throughput for a range of chunk sizes on a scratch file of
+// `sample_size` bytes created in `scratch_dir` (and removed afterwards), and return the fastest
+// size of each by the median of several passes. Write passes include syncing the data to the
+// storage, and cached pages of the sample are dropped before every read pass, so reads hit the
+// storage where the kernel allows it. Measurements are reported on `report`.
+IoTuning calibrateIoTuning(const fs::path& scratch_dir, std::uint64_t sample_size,
+                           std::ostream& report);
+
+} // namespace packer
@@ -0,0 +1,44 @@
+#include "locality.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace packer {
+
+namespace {
+
+void adviseFile(const fs::path& path, [[maybe_unused]] int advice) {
+#if defined(POSIX_FADV_WILLNEED) && defined(POSIX_FADV_DONTNEED)
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return; // an unreadable file is reported later, when it is actually read
+    }
+    ::posix_fadvise(fd, 0, 0, advice);
+    ::close(fd);
+#endif
+}
+
+} // namespace
+
+std::uint64_t fileInode(const fs::path& path) {
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<std::uint64_t>(st.st_ino);
+}
+
+void adviseWillNeed(const fs::path& path) {
+#ifdef POSIX_FADV_WILLNEED
+    adviseFile(path, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void adviseDontNeed(const fs::path& path) {
+#ifdef POSIX_FADV_DONTNEED
+    adviseFile(path, POSIX_FADV_DONTNEED);
+#endif
+}
+
+} // namespace packer
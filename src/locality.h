@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// Helpers used by the locality-ordered traversal. All of them are best-effort:
+// on platforms or filesystems without the underlying facility they degrade to no-ops.
+
+// return the inode number of a path (without following symlinks), 0 if unavailable
+std::uint64_t fileInode(const fs::path& path);
+
+// hint the kernel that the file's content will be read soon
+void adviseWillNeed(const fs::path& path);
+
+// hint the kernel that the file's cached content is no longer needed
+void adviseDontNeed(const fs::path& path);
+
+} // namespace packer
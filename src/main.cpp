@@ -1,55 +1,236 @@
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
+#include "filelistinputtree.h"
+#include "iotuning.h"
 #include "packer.h"
 #include "xxhasher.h"
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
 
-bool parse_arguments(int argc, char* argv[], bool& is_pack, std::filesystem::path& input_path,
-                     std::filesystem::path& output_path) {
-    if (argc != 4) {
-        std::cerr << "Usage:" << std::endl;
-        std::cerr << argv[0] << " pack <input_path> <output_file>" << std::endl;
-        std::cerr << "or" << std::endl;
-        std::cerr << argv[0] << " unpack <input_file> <output_path>" << std::endl;
+struct Arguments {
+    std::string command;
+    std::filesystem::path input_path;
+    std::filesystem::path output_path;
+    // blob store given with --store, or the store directory of the gc command
+    std::optional<std::filesystem::path> store_path;
+    // list of paths to pack given with --files-from, "-" for standard input
+    std::optional<std::string> files_from;
+    // size of the scratch file written by calibrate, in MiB
+    std::uint64_t sample_size_mib = 64;
+    packer::PackOptions pack_options;
+    packer::UnpackOptions unpack_options;
+};
+
+void print_usage(const char* program) {
+    std::cerr << "Usage:" << std::endl;
+    std::cerr << program
+              << " pack [--locality] [--delta] [--name-table] [--store <dir>]"
+                 " [--files-from <list|->] <input_path> <output_file>"
+              << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program
+              << " unpack [--include <glob>]... [--exclude <glob>]... [--sync=none|end|batch]"
+                 " [--update [--remove-stale]] [--store <dir>] <input_file> <output_path>"
+              << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program << " verify <input_file>" << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program << " export --store <dir> <input_file> <output_file>" << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program << " release --store <dir> <input_file>" << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program << " gc <store_dir>" << std::endl;
+    std::cerr << "or" << std::endl;
+    std::cerr << program << " calibrate [--sample-size <MiB>] <scratch_dir>" << std::endl;
+}
+
+bool parse_arguments(int argc, char* argv[], Arguments& args) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return false;
+    }
+
+    args.command = argv[1];
+    const bool is_pack = args.command == "pack";
+    const bool is_unpack = args.command == "unpack";
+    const bool is_export = args.command == "export";
+    const bool is_release = args.command == "release";
+    const bool is_gc = args.command == "gc";
+    const bool is_calibrate = args.command == "calibrate";
+    if (!is_pack && !is_unpack && !is_export && !is_release && !is_gc && !is_calibrate &&
+        args.command != "verify") {
+        std::cerr << "Invalid command: " << args.command << std::endl;
         return false;
     }
+    const bool accepts_store = is_pack || is_unpack || is_export || is_release;
 
-    std::string command = argv[1];
-    if (command == "pack") {
-        is_pack = true;
-    } else if (command == "unpack") {
-        is_pack = false;
-    } else {
-        std::cerr << "Invalid command: " << command << std::endl;
+    std::vector<std::string> positional;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (is_pack && arg == "--locality") {
+            args.pack_options.locality_order = true;
+        } else if (is_pack && arg == "--delta") {
+            args.pack_options.delta_encoding = true;
+        } else if (is_pack && arg == "--name-table") {
+            args.pack_options.name_table = true;
+        } else if (is_pack && arg == "--files-from") {
+            if (++i == argc) {
+                std::cerr << "Missing file list after " << arg << std::endl;
+                return false;
+            }
+            args.files_from = argv[i];
+        } else if (is_calibrate && arg == "--sample-size") {
+            if (++i == argc) {
+                std::cerr << "Missing size after " << arg << std::endl;
+                return false;
+            }
+            char* end = nullptr;
+            args.sample_size_mib = std::strtoull(argv[i], &end, 10);
+            if (*end != '\0' || args.sample_size_mib == 0) {
+                std::cerr << "Invalid sample size: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (accepts_store && arg == "--store") {
+            if (++i == argc) {
+                std::cerr << "Missing directory after " << arg << std::endl;
+                return false;
+            }
+            args.store_path = std::filesystem::path(argv[i]);
+        } else if (is_unpack && (arg == "--include" || arg == "--exclude")) {
+            if (++i == argc) {
+                std::cerr << "Missing glob pattern after " << arg << std::endl;
+                return false;
+            }
+            auto& patterns = arg == "--include" ? args.unpack_options.include_patterns
+                                                : args.unpack_options.exclude_patterns;
+            patterns.push_back(argv[i]);
+        } else if (is_unpack && arg == "--update") {
+            args.unpack_options.update = true;
+        } else if (is_unpack && arg == "--remove-stale") {
+            args.unpack_options.remove_stale = true;
+        } else if (is_unpack && arg.rfind("--sync=", 0) == 0) {
+            const std::string mode = arg.substr(std::strlen("--sync="));
+            if (mode == "none") {
+                args.unpack_options.sync = packer::sync_mode::none;
+            } else if (mode == "end") {
+                args.unpack_options.sync = packer::sync_mode::end;
+            } else if (mode == "batch") {
+                args.unpack_options.sync = packer::sync_mode::batch;
+            } else {
+                std::cerr << "Invalid sync mode: " << mode << std::endl;
+                return false;
+            }
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Invalid option for " << args.command << ": " << arg << std::endl;
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    const std::size_t expected_positional =
+        (args.command == "verify" || is_release || is_gc || is_calibrate) ? 1 : 2;
+    if (positional.size() != expected_positional) {
+        print_usage(argv[0]);
         return false;
     }
-    input_path = std::filesystem::path(argv[2]);
-    output_path = std::filesystem::path(argv[3]);
+    if (args.unpack_options.remove_stale && !args.unpack_options.update) {
+        std::cerr << "--remove-stale requires --update" << std::endl;
+        return false;
+    }
+    if ((is_export || is_release) && !args.store_path) {
+        std::cerr << "Missing --store for " << args.command << std::endl;
+        return false;
+    }
+    if (is_gc) {
+        args.store_path = std::filesystem::path(positional[0]);
+        return true;
+    }
+    args.input_path = std::filesystem::path(positional[0]);
+    if (expected_positional > 1) {
+        args.output_path = std::filesystem::path(positional[1]);
+    }
     return true;
 }
 
 int main(int argc, char* argv[]) {
-    bool is_pack = false;
-    std::filesystem::path input_path;
-    std::filesystem::path output_path;
-
-    if (!parse_arguments(argc, argv, is_pack, input_path, output_path)) {
+    Arguments args;
+    if (!parse_arguments(argc, argv, args)) {
         return 1;
     }
 
-    packer::XXHasher hasher;
-    packer::Packer packer{hasher};
+    args.unpack_options.verbose = true;
+
     try {
-        if (is_pack)
-            packer.pack(input_path, output_path);
-        else
-            packer.unpack(input_path, output_path);
+        if (args.command == "calibrate") {
+            const std::filesystem::path tuning_path = packer::defaultIoTuningPath();
+            if (tuning_path.empty()) {
+                throw std::runtime_error("No location for the tuning file, set PACKER_TUNING_FILE");
+            }
+            const packer::IoTuning tuning = packer::calibrateIoTuning(
+                args.input_path, args.sample_size_mib * 1024 * 1024, std::cout);
+            packer::saveIoTuning(tuning, tuning_path);
+            std::cout << "Saved read chunk " << tuning.read_chunk_size << ", hash chunk "
+                      << tuning.hash_chunk_size << ", write chunk " << tuning.write_chunk_size
+                      << " to " << tuning_path << std::endl;
+            return 0;
+        }
+
+        // chunk sizes saved by calibrate, or the built-in defaults
+        const std::filesystem::path tuning_path = packer::defaultIoTuningPath();
+        const packer::IoTuning tuning =
+            tuning_path.empty() ? packer::IoTuning{} : packer::loadIoTuning(tuning_path);
+        packer::XXHasher hasher;
+        packer::Packer packer{hasher, tuning};
+
+        std::unique_ptr<packer::BlobStore> store;
+        if (args.store_path) {
+            // unpack and export only read blobs and share the store with each other
+            const bool read_only = args.command == "unpack" || args.command == "export";
+            store = std::make_unique<packer::BlobStore>(
+                *args.store_path,
+                read_only ? packer::store_access::read_only : packer::store_access::read_write);
+            args.pack_options.store = store.get();
+            args.unpack_options.store = store.get();
+        }
+        if (args.files_from) {
+            std::ifstream list_file;
+            if (*args.files_from != "-") {
+                list_file.open(*args.files_from, std::ios::binary);
+                if (!list_file.is_open()) {
+                    throw std::runtime_error("Failed to open file list: " + *args.files_from);
+                }
+            }
+            std::istream& list = *args.files_from == "-" ? std::cin : list_file;
+            args.pack_options.file_list = packer::FileListInputTree::readList(list);
+        }
+
+        if (args.command == "pack")
+            packer.pack(args.input_path, args.output_path, args.pack_options);
+        else if (args.command == "unpack")
+            packer.unpack(args.input_path, args.output_path, args.unpack_options);
+        else if (args.command == "export")
+            packer.exportArchive(args.input_path, *store, args.output_path);
+        else if (args.command == "release") {
+            if (!packer.releaseArchive(args.input_path, *store)) {
+                std::cerr << "Archive was not registered in the store" << std::endl;
+                return 1;
+            }
+        } else if (args.command == "gc")
+            std::cout << "Reclaimed " << store->collectGarbage() << " bytes" << std::endl;
+        else if (!packer.verify(args.input_path))
+            return 1;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,166 @@
+#include "memorytree.h"
+
+#include "archivestreams.h"
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace packer {
+
+void MemoryTree::addDirectory(const fs::path& path) {
+    insert(path, file_type::directory);
+}
+
+void MemoryTree::addFile(const fs::path& path, std::string content) {
+    insert(path, file_type::regular).data = std::move(content);
+}
+
+void MemoryTree::addSymlink(const fs::path& path, const fs::path& target) {
+    insert(path, file_type::symlink).data = target.string();
+}
+
+const MemoryTree::Node* MemoryTree::find(const fs::path& path) const {
+    const Node* node = &root_;
+    for (const fs::path& component : path.relative_path()) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        const auto it = node->children.find(component.string());
+        if (it == node->children.end()) {
+            return nullptr;
+        }
+        node = &it->second;
+    }
+    return node;
+}
+
+MemoryTree::Node& MemoryTree::insert(const fs::path& path, file_type type) {
+    Node* node = &root_;
+    for (const fs::path& component : path.relative_path()) {
+        if (component.empty() || component == ".") {
+            continue;
+        }
+        if (component == "..") {
+            throw std::runtime_error("Path escapes the memory tree: " + path.string());
+        }
+        if (node->type != file_type::directory) {
+            throw std::runtime_error("Not a directory in memory tree path: " + path.string());
+        }
+        // new nodes are directories until the type of the last one is set below
+        node = &node->children[component.string()];
+    }
+    if (node == &root_) {
+        if (type != file_type::directory) {
+            throw std::runtime_error("Cannot replace the root of a memory tree");
+        }
+        return root_;
+    }
+    if (node->type != type) {
+        *node = Node{type, {}, {}};
+    }
+    return *node;
+}
+
+const MemoryTree::Node& MemoryTree::get(const fs::path& path, file_type type) const {
+    const Node* node = find(path);
+    if (node == nullptr || node->type != type) {
+        std::ostringstream message;
+        message << "No " << type << " entry in memory tree: " << path.string();
+        throw std::runtime_error(message.str());
+    }
+    return *node;
+}
+
+void MemoryTree::traverse(const Visitor& visit) {
+    traverseNode(visit, root_, fs::path(), 0);
+}
+
+void MemoryTree::traverseNode(const Visitor& visit, const Node& node, const fs::path& path,
+                              int depth) {
+    for (const auto& [name, child] : node.children) {
+        const InputEntry entry{path / name, child.type, depth};
+        if (visit(entry) && child.type == file_type::directory) {
+            traverseNode(visit, child, entry.path, depth + 1);
+        }
+    }
+}
+
+std::uint64_t MemoryTree::fileSize(const fs::path& path) const {
+    return get(path, file_type::regular).data.size();
+}
+
+std::unique_ptr<std::istream> MemoryTree::openFile(const fs::path& path) const {
+    const std::string& content = get(path, file_type::regular).data;
+    return std::make_unique<SpanIStream>(content.data(), content.size());
+}
+
+fs::path MemoryTree::readSymlink(const fs::path& path) const {
+    return fs::path(get(path, file_type::symlink).data);
+}
+
+void MemoryTree::createDirectory(const fs::path& path) {
+    insert(path, file_type::directory);
+}
+
+void MemoryTree::writeFile(const fs::path& path, std::istream& data, std::uint64_t size) {
+    std::string content(size, '\0');
+    data.read(content.data(), static_cast<std::streamsize>(size));
+    if (static_cast<std::uint64_t>(data.gcount()) != size) {
+        throw std::runtime_error("Unexpected EOF while extracting file: " + path.string());
+    }
+    insert(path, file_type::regular).data = std::move(content);
+}
+
+void MemoryTree::createSymlink(const fs::path& path, const fs::path& target) {
+    insert(path, file_type::symlink).data = target.string();
+}
+
+std::optional<std::uint64_t> MemoryTree::existingFileSize(const fs::path& path) const {
+    const Node* node = find(path);
+    if (node == nullptr || node->type != file_type::regular) {
+        return std::nullopt;
+    }
+    return node->data.size();
+}
+
+std::unique_ptr<std::istream> MemoryTree::openExistingFile(const fs::path& path) const {
+    return openFile(path);
+}
+
+std::optional<fs::path> MemoryTree::existingSymlinkTarget(const fs::path& path) const {
+    const Node* node = find(path);
+    if (node == nullptr || node->type != file_type::symlink) {
+        return std::nullopt;
+    }
+    return fs::path(node->data);
+}
+
+std::vector<std::string> MemoryTree::listDirectory(const fs::path& path) const {
+    std::vector<std::string> names;
+    const Node* node = find(path);
+    if (node != nullptr && node->type == file_type::directory) {
+        for (const auto& child : node->children) {
+            names.push_back(child.first);
+        }
+    }
+    return names;
+}
+
+void MemoryTree::replaceFile(const fs::path& path, std::istream& data, std::uint64_t size) {
+    writeFile(path, data, size);
+}
+
+void MemoryTree::replaceSymlink(const fs::path& path, const fs::path& target) {
+    createSymlink(path, target);
+}
+
+void MemoryTree::removeEntry(const fs::path& path) {
+    const fs::path parent_path = path.parent_path();
+    Node* parent = const_cast<Node*>(find(parent_path));
+    if (parent == nullptr || parent == find(path)) {
+        throw std::runtime_error("Cannot remove memory tree entry: " + path.string());
+    }
+    parent->children.erase(path.filename().string());
+}
+
+} // namespace packer
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "inputtree.h"
+#include "outputtree.h"
+#include <map>
+#include <string>
+
+namespace packer {
+
+// Directory tree held in memory. It can be packed as an input tree and unpacked into as an
+// output tree, so archives can be created and extracted without touching the filesystem.
+class MemoryTree : public InputTree, public OutputTree {
+  public:
+    struct Node {
+        file_type type = file_type::directory;
+        // content of a regular file or target of a symlink
+        std::string data;
+        // entries of a directory ordered by name
+        std::map<std::string, Node> children;
+    };
+
+    // add entries, creating missing parent directories; an existing entry is replaced
+    void addDirectory(const fs::path& path);
+    void addFile(const fs::path& path, std::string content);
+    void addSymlink(const fs::path& path, const fs::path& target);
+
+    // entry at a path relative to the root, nullptr if there is none
+    const Node* find(const fs::path& path) const;
+    const Node& root() const { return root_; }
+
+    // InputTree
+    void traverse(const Visitor& visit) override;
+    std::uint64_t fileSize(const fs::path& path) const override;
+    std::unique_ptr<std::istream> openFile(const fs::path& path) const override;
+    fs::path readSymlink(const fs::path& path) const override;
+
+    // OutputTree
+    void createDirectory(const fs::path& path) override;
+    void writeFile(const fs::path& path, std::istream& data, std::uint64_t size) override;
+    void createSymlink(const fs::path& path, const fs::path& target) override;
+    std::optional<std::uint64_t> existingFileSize(const fs::path& path) const override;
+    std::unique_ptr<std::istream> openExistingFile(const fs::path& path) const override;
+    std::optional<fs::path> existingSymlinkTarget(const fs::path& path) const override;
+    std::vector<std::string> listDirectory(const fs::path& path) const override;
+    // replacing is a single step in memory anyway
+    void replaceFile(const fs::path& path, std::istream& data, std::uint64_t size) override;
+    void replaceSymlink(const fs::path& path, const fs::path& target) override;
+    void removeEntry(const fs::path& path) override;
+
+  private:
+    // node at `path`, created (with missing parent directories) as `type` if needed
+    Node& insert(const fs::path& path, file_type type);
+    // node at `path` which must exist and have the given type
+    const Node& get(const fs::path& path, file_type type) const;
+
+    void traverseNode(const Visitor& visit, const Node& node, const fs::path& path, int depth);
+
+    Node root_;
+};
+
+} // namespace packer
@@ -0,0 +1,64 @@
+#include "nametable.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace packer {
+
+std::optional<std::uint32_t> NameTable::find(std::string_view name) const {
+    const auto it = ids_.find(name);
+    if (it == ids_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::string_view NameTable::add(std::string_view name, bool index) {
+    if (blocks_.empty() || blocks_.back().capacity - blocks_.back().used < name.size()) {
+        Block block;
+        block.capacity = std::max(BLOCK_SIZE, name.size());
+        block.data = std::make_unique<char[]>(block.capacity);
+        blocks_.push_back(std::move(block));
+    }
+    Block& block = blocks_.back();
+    char* stored = block.data.get() + block.used;
+    std::memcpy(stored, name.data(), name.size());
+    block.used += name.size();
+
+    const std::string_view view(stored, name.size());
+    if (index) {
+        ids_.emplace(view, static_cast<std::uint32_t>(names_.size()));
+    }
+    names_.push_back(view);
+    return view;
+}
+
+std::string_view NameTable::get(std::uint64_t id) const {
+    if (id >= names_.size()) {
+        throw std::runtime_error("Archive format error: reference to unknown name id " +
+                                 std::to_string(id));
+    }
+    return names_[id];
+}
+
+// the bytes of forgotten names stay in their block, rollbacks are rare
+void NameTable::truncate(std::size_t size) {
+    while (names_.size() > size) {
+        const auto it = ids_.find(names_.back());
+        if (it != ids_.end() && it->second == names_.size() - 1) {
+            ids_.erase(it);
+        }
+        names_.pop_back();
+    }
+}
+
+void NameTable::clear() {
+    blocks_.clear();
+    names_.clear();
+    ids_.clear();
+}
+
+} // namespace packer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace packer {
+
+// String table of the entry names of an archive, see ARCHIVE_FLAG_NAME_TABLE.
+//
+// Names get consecutive ids in the order they are added. Name bytes are copied into large
+// blocks that are never moved, so the views handed out stay valid until the table is cleared and
+// adding a name does not allocate unless a block fills up.
+class NameTable {
+  public:
+    // id of a name added before, if any; only names added with `index` are found
+    std::optional<std::uint32_t> find(std::string_view name) const;
+    // add a name, returning a view of the stored copy; `index` makes it visible to find,
+    // which only the writing side of an archive needs
+    std::string_view add(std::string_view name, bool index = false);
+    // name with the given id, throws std::runtime_error for ids not assigned yet
+    std::string_view get(std::uint64_t id) const;
+
+    std::size_t size() const { return names_.size(); }
+    // forget the names with ids from `size` on, e.g. those of an entry that was rolled back
+    void truncate(std::size_t size);
+    void clear();
+
+  private:
+    static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        std::size_t capacity = 0;
+        std::size_t used = 0;
+    };
+
+    std::vector<Block> blocks_;
+    std::vector<std::string_view> names_;
+    std::unordered_map<std::string_view, std::uint32_t> ids_;
+};
+
+} // namespace packer
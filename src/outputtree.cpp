@@ -0,0 +1,37 @@
+#include "outputtree.h"
+
+#include <stdexcept>
+
+namespace packer {
+
+std::optional<std::uint64_t> OutputTree::existingFileSize(const fs::path&) const {
+    return std::nullopt;
+}
+
+std::unique_ptr<std::istream> OutputTree::openExistingFile(const fs::path& path) const {
+    throw std::runtime_error("Output tree cannot read back file: " + path.string());
+}
+
+std::optional<fs::path> OutputTree::existingSymlinkTarget(const fs::path&) const {
+    return std::nullopt;
+}
+
+std::vector<std::string> OutputTree::listDirectory(const fs::path&) const { return {}; }
+
+void OutputTree::replaceFile(const fs::path& path, std::istream& data, std::uint64_t size) {
+    writeFile(path, data, size);
+}
+
+void OutputTree::replaceSymlink(const fs::path& path, const fs::path& target) {
+    createSymlink(path, target);
+}
+
+void OutputTree::replaceDirectory(const fs::path& path) {
+    createDirectory(path);
+}
+
+void OutputTree::removeEntry(const fs::path& path) {
+    throw std::runtime_error("Output tree cannot remove entry: " + path.string());
+}
+
+} // namespace packer
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// Destination of the entries extracted from an archive by Packer::unpack.
+// All paths are relative to the root of the tree, which is expected to exist.
+class OutputTree {
+  public:
+    virtual ~OutputTree() = default;
+
+    // create a directory together with any missing parent directories
+    virtual void createDirectory(const fs::path& path) = 0;
+    // create or replace a regular file with exactly `size` bytes read from `data`
+    virtual void writeFile(const fs::path& path, std::istream& data, std::uint64_t size) = 0;
+    // create a symbolic link pointing to `target`
+    virtual void createSymlink(const fs::path& path, const fs::path& target) = 0;
+    // called once after all entries were extracted
+    virtual void finish() {}
+
+    // Incremental extraction over existing content (UnpackOptions::update). Trees that cannot
+    // inspect what they hold keep the defaults, for which every entry looks missing.
+
+    // size of an existing regular file, nullopt if there is no regular file at `path`
+    virtual std::optional<std::uint64_t> existingFileSize(const fs::path& path) const;
+    // open an existing regular file for reading, throws std::runtime_error on failure
+    virtual std::unique_ptr<std::istream> openExistingFile(const fs::path& path) const;
+    // target of an existing symbolic link, nullopt if there is no symlink at `path`
+    virtual std::optional<fs::path> existingSymlinkTarget(const fs::path& path) const;
+    // names of the entries of an existing directory, empty if there is no directory at `path`
+    virtual std::vector<std::string> listDirectory(const fs::path& path) const;
+    // like writeFile and createSymlink, but an existing entry at `path` is replaced in one step
+    // so that it is never seen partially written
+    virtual void replaceFile(const fs::path& path, std::istream& data, std::uint64_t size);
+    virtual void replaceSymlink(const fs::path& path, const fs::path& target);
+    // like createDirectory, but existing entries of another type on the path are replaced
+    virtual void replaceDirectory(const fs::path& path);
+    // remove an entry, together with its content if it is a directory
+    virtual void removeEntry(const fs::path& path);
+};
+
+} // namespace packer
@@ -1,133 +1,409 @@
 #include "packer.h"
 
+#include "archiveformat.h"
+#include "archivestreams.h"
 #include "byteorder.h"
+#include "delta.h"
+#include "entryheader.h"
+#include "filelistinputtree.h"
 #include "filetype.h"
+#include "fsinputtree.h"
+#include "fsoutputtree.h"
+#include "hashworkerpool.h"
 #include "ifstream_exc.h"
+#include "pathfilter.h"
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <random>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace packer {
 
-Packer::Packer(const StreamHasher& stream_hasher) : hasher_(stream_hasher) {
-    archive_file_.exceptions(std::ios::failbit | std::ios::badbit);
+namespace {
+
+// fixed-width fields are read without exceptions, check their outcome explicitly
+void requireGood(const std::istream& archive_in, const char* what) {
+    if (!archive_in) {
+        throw std::runtime_error(std::string("Unexpected EOF while reading ") + what +
+                                 " from archive");
+    }
+}
+
+// an entry name must be a single path component to stay inside the output directory; a NUL
+// would cut the name short when passed to the system
+bool isPlainEntryName(std::string_view entry_name) {
+    constexpr std::string_view FORBIDDEN("/\0", 2);
+    return !entry_name.empty() && entry_name.find_first_of(FORBIDDEN) == std::string_view::npos &&
+           entry_name != "." && entry_name != "..";
+}
+
+// read an unsigned LEB128 varint, see HeaderBuffer::appendVarint
+std::uint64_t readVarint(std::istream& archive_in, const char* what) {
+    std::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        const std::istream::int_type byte = archive_in.get();
+        if (byte == std::istream::traits_type::eof()) {
+            throw std::runtime_error(std::string("Unexpected EOF while reading ") + what +
+                                     " from archive");
+        }
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::runtime_error(std::string("Archive format error: overlong varint in ") + what);
+}
+
+// sets the exception mask of a caller's stream and restores the original one when done
+class ExceptionMaskGuard {
+  public:
+    ExceptionMaskGuard(std::ios& stream, std::ios::iostate mask)
+        : stream_(stream), saved_mask_(stream.exceptions()) {
+        stream_.exceptions(mask);
+    }
+    ~ExceptionMaskGuard() {
+        try {
+            stream_.exceptions(saved_mask_);
+        } catch (const std::ios_base::failure&) {
+            // the stream is already in a failed state the caller will observe
+        }
+    }
+    ExceptionMaskGuard(const ExceptionMaskGuard&) = delete;
+    ExceptionMaskGuard& operator=(const ExceptionMaskGuard&) = delete;
+
+  private:
+    std::ios& stream_;
+    const std::ios::iostate saved_mask_;
+};
+
+// read exactly `size` bytes of a file into memory
+std::vector<char> readContent(std::istream& file_in, std::size_t size, const fs::path& file_path) {
+    std::vector<char> content(size);
+    file_in.read(content.data(), static_cast<std::streamsize>(size));
+    if (static_cast<std::size_t>(file_in.gcount()) != size) {
+        throw std::runtime_error("Unexpected EOF while reading file: " + file_path.string());
+    }
+    return content;
 }
 
-Packer::~Packer() {
-    if (archive_file_.is_open()) {
-        archive_file_.close();
+// copy exactly `length` bytes of the data of entry `entry_name` through `buffer`
+void copyData(std::istream& in, std::ostream& out, std::uint64_t length,
+              const BufferPool::Buffer& buffer, std::string_view entry_name) {
+    while (length > 0) {
+        const std::streamsize to_read =
+            static_cast<std::streamsize>(std::min<std::uint64_t>(length, buffer.size()));
+        in.read(buffer.data(), to_read);
+        if (in.gcount() != to_read) {
+            throw std::runtime_error("Unexpected EOF while reading data of " +
+                                     std::string(entry_name));
+        }
+        out.write(buffer.data(), to_read);
+        length -= static_cast<std::uint64_t>(to_read);
     }
 }
 
+// random id an archive is registered under in a blob store
+ArchiveId newArchiveId() {
+    std::random_device random;
+    ArchiveId archive_id;
+    for (std::size_t i = 0; i < archive_id.size(); i += sizeof(std::uint32_t)) {
+        const std::uint32_t value = random();
+        std::memcpy(archive_id.data() + i, &value, sizeof(value));
+    }
+    return archive_id;
+}
+
+} // namespace
+
+Packer::Packer(const StreamHasher& stream_hasher, const IoTuning& tuning)
+    : hasher_(stream_hasher), tuning_(tuning) {}
+
+// Archive header: [4 bytes: magic "PAKR"][2 bytes: format flags]
+// With ARCHIVE_FLAG_BLOB_REFS the header ends with [16 bytes: blob store archive id]
 // Archive format per entry:
 // Metadata: [1 byte: file type][2 bytes:: path length][path bytes]
 // Followed by content depending on file type:
-// For regular files: [4 bytes: data length][file content bytes]
+// For regular files: [4 bytes: data length][8 bytes: content checksum][file content bytes]
 // For duplicate files: [8 bytes: offset of original file data]
 // For symlinks: [2 bytes: target path length][target path bytes]
+// For blob references: [8 bytes: hash low][8 bytes: hash high][8 bytes: blob size]
+// For delta encoded files: [8 bytes: offset of base file data][4 bytes: file length]
+//                          [8 bytes: content checksum][4 bytes: delta length][delta bytes]
 // when leaving directories:
 // [1 byte: file_type::leave_directory][2 bytes: depth decrease]
-void Packer::pack(const fs::path& input_path, const fs::path& archive_path) {
-    input_root_ = input_path;
-    archive_file_.open(archive_path, std::ios::binary);
+void Packer::pack(const fs::path& input_path, const fs::path& archive_path,
+                  const PackOptions& options) {
+    std::unique_ptr<InputTree> input;
+    if (options.file_list) {
+        input = std::make_unique<FileListInputTree>(input_path, *options.file_list);
+    } else {
+        input = std::make_unique<FsInputTree>(input_path, options.locality_order);
+    }
+    std::ofstream archive_file;
+    archive_file.exceptions(std::ios::failbit | std::ios::badbit);
+    archive_file.open(archive_path, std::ios::binary);
+
+    pack(*input, archive_file, options);
+
+    const std::uintmax_t archive_size = static_cast<std::uintmax_t>(archive_file.tellp());
+    archive_file.close();
+    // a failed last entry was rolled back by seeking, drop its bytes from the end of the file
+    if (fs::file_size(archive_path) > archive_size) {
+        fs::resize_file(archive_path, archive_size);
+    }
+}
+
+void Packer::pack(InputTree& input, std::ostream& archive_out, const PackOptions& options) {
+    // rolling back failed entries relies on write errors being reported as exceptions
+    ExceptionMaskGuard exception_guard(archive_out, std::ios::failbit | std::ios::badbit);
+    input_ = &input;
+    archive_out_ = &archive_out;
     this->current_depth_ = 0;
     this->file_hash_to_paths_.clear();
+    store_ = options.store;
+    referenced_blobs_.clear();
+    delta_encoding_ = options.delta_encoding && store_ == nullptr;
+    similarity_index_.clear();
+    delta_input_bytes_ = 0;
+    delta_work_bytes_ = 0;
 
-    for (auto it = fs::recursive_directory_iterator(input_path, fs::directory_options::none);
-         it != fs::recursive_directory_iterator(); ++it) {
+    std::uint16_t flags = ARCHIVE_FLAG_CHECKSUMS;
+    if (options.name_table) {
+        flags |= ARCHIVE_FLAG_NAME_TABLE;
+    }
+    if (store_ != nullptr) {
+        flags |= ARCHIVE_FLAG_BLOB_REFS;
+        archive_id_ = newArchiveId();
+    }
+    writeArchiveHeader(flags);
+    input.traverse([this](const InputEntry& entry) { return tryAddEntry(entry); });
+    archive_out.flush();
 
-        const fs::directory_entry& entry = *it;
-        std::streamoff entry_offset = 0;
-        try {
-            entry_offset = archive_file_.tellp();
-            add_entry(entry, it.depth());
-        } catch (const std::runtime_error& e) {
-            archive_file_.seekp(entry_offset); // rollback to before entry
-            std::cerr << "Error packing entry " << entry.path() << ": " << e.what() << std::endl;
-            continue;
-        }
+    if (store_ != nullptr) {
+        store_->registerArchive(archive_id_, referenced_blobs_);
+        store_->save();
     }
 }
 
-void Packer::unpack(const fs::path& archive_path, const fs::path& output_path) {
-    // open archive for reading
-    ifstream_exc archive_in(archive_path, std::ios::binary);
+bool Packer::tryAddEntry(const InputEntry& entry) {
+    std::streamoff entry_offset = 0;
+    const int depth_before = current_depth_;
+    const std::size_t names_before = output_names_.size();
+    try {
+        entry_offset = archive_out_->tellp();
+        add_entry(entry);
+    } catch (const std::runtime_error& e) {
+        archive_out_->seekp(entry_offset); // rollback to before entry
+        current_depth_ = depth_before;
+        // a name first written by the dropped entry must be written again by the next one
+        output_names_.truncate(names_before);
+        std::cerr << "Error packing entry " << entry.path << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    fs::path current_directory = output_path;
+// Entries are always parsed in full to track the current directory, but file data of entries not
+// selected by the filter is skipped with a seek instead of being read. Directories are created
+// when selected themselves or when a selected entry is extracted into them.
+void Packer::unpack(std::istream& archive_in, OutputTree& output, const UnpackOptions& options) {
+    extractArchiveHeader(archive_in);
+    if ((archive_flags_ & ARCHIVE_FLAG_BLOB_REFS) != 0 && options.store == nullptr) {
+        throw std::runtime_error("Archive keeps its file data in a blob store, none was given");
+    }
+    if (options.remove_stale && !options.update) {
+        throw std::runtime_error("Removing stale entries requires an update");
+    }
+    // progress is reported only when requested, otherwise it goes to a stream without a buffer
+    std::ostream null_log(nullptr);
+    std::ostream& log = options.verbose ? std::cout : null_log;
 
-    file_type ft;
-    fs::path entry_name;
-    while (extractMetadata(archive_in, ft, entry_name)) {
-        fs::path full_entry_path = current_directory / entry_name;
-        std::cout << "File path: " << full_entry_path << std::endl;
+    const PathFilter filter(options.include_patterns, options.exclude_patterns);
+    // selection state of the current directory and all its parents
+    std::vector<PathFilter::Selection> directory_selections{filter.root()};
 
-        switch (ft) {
-            case file_type::directory: {
-                // push directory component and create it
-                fs::create_directories(full_entry_path);
-                std::cout << "Created directory: " << full_entry_path << std::endl;
-                current_directory = full_entry_path;
-                break;
+    fs::path current_directory;
+    // most recent directory known to exist, saves re-checking it for every extracted entry
+    fs::path existing_directory;
+    auto ensureCurrentDirectory = [&]() {
+        if (current_directory != existing_directory) {
+            if (options.update) {
+                output.replaceDirectory(current_directory);
+            } else {
+                output.createDirectory(current_directory);
             }
-            case file_type::leave_directory: {
-                // read depth decrease
-                std::uint16_t depth_decrease = packer::read_le16(archive_in);
-                if (depth_decrease == 0) {
+            existing_directory = current_directory;
+        }
+    };
+    // all entry paths of the archive and the directories extracted, for removing stale entries
+    std::unordered_set<std::string> archived_paths;
+    std::unordered_set<std::string> extracted_directories{""};
+    auto writeOutputFile = [&](const fs::path& path, std::istream& data, std::uint64_t size) {
+        if (options.update) {
+            output.replaceFile(path, data, size);
+        } else {
+            output.writeFile(path, data, size);
+        }
+    };
+
+    file_type ft;
+    std::string_view entry_name;
+    const char* payload = nullptr;
+    while (extractMetadata(archive_in, ft, entry_name, payload)) {
+        if (ft == file_type::leave_directory) {
+            auto [depth_decrease] = DepthDecreaseLayout::decode(payload);
+            if (depth_decrease == 0) {
+                throw std::runtime_error(
+                    "Archive format error: zero depth decrease on leave_directory");
+            }
+            while (depth_decrease-- > 0) {
+                if (current_directory.empty()) {
                     throw std::runtime_error(
-                        "Archive format error: zero depth decrease on leave_directory");
+                        "Archive format error: attempt to leave root directory");
                 }
-                while (depth_decrease-- > 0) {
-                    if (current_directory == output_path) {
-                        throw std::runtime_error(
-                            "Archive format error: attempt to leave root directory");
-                    }
-                    current_directory = current_directory.parent_path();
+                current_directory = current_directory.parent_path();
+                directory_selections.pop_back();
+            }
+            log << "Moved up to directory: " << current_directory << std::endl;
+            continue;
+        }
+
+        // names are joined to output paths, which must not escape the output directory
+        if (!isPlainEntryName(entry_name)) {
+            throw std::runtime_error("Invalid entry name: " + std::string(entry_name));
+        }
+        const fs::path entry_path = current_directory / fs::path(entry_name);
+        const PathFilter::Selection selection =
+            filter.select(directory_selections.back(), entry_path);
+        if (selection.selected()) {
+            log << "File path: " << entry_path << std::endl;
+        }
+        if (options.remove_stale) {
+            archived_paths.insert(entry_path.generic_string());
+            if (ft == file_type::directory && selection.selected()) {
+                extracted_directories.insert(entry_path.generic_string());
+            }
+        }
+
+        switch (ft) {
+            case file_type::directory: {
+                // push directory component and create it if selected
+                current_directory = entry_path;
+                directory_selections.push_back(selection);
+                if (selection.selected()) {
+                    ensureCurrentDirectory();
+                    log << "Created directory: " << entry_path << std::endl;
                 }
-                std::cout << "Moved up to directory: " << current_directory << std::endl;
                 break;
             }
             case file_type::regular: {
-                extractFileData(archive_in, full_entry_path);
-                std::cout << "Extracted regular file: " << full_entry_path << std::endl;
+                const auto [data_len, checksum] = decodeFileData(payload);
+                if (!selection.selected()) {
+                    archive_in.seekg(data_len, std::ios::cur);
+                    break;
+                }
+                ensureCurrentDirectory();
+                if (options.update &&
+                    outputFileIsCurrent(output, entry_path, archive_in, data_len, checksum)) {
+                    archive_in.seekg(data_len, std::ios::cur);
+                    log << "Unchanged regular file: " << entry_path << std::endl;
+                    break;
+                }
+                writeOutputFile(entry_path, archive_in, data_len);
+                log << "Extracted regular file: " << entry_path << std::endl;
                 break;
             }
             case file_type::duplicate: {
-                // read offset of original file (where its 4-byte length is stored)
-                const std::streamoff orig_offset = packer::read_le64(archive_in);
+                // offset of original file (where its 4-byte length is stored)
+                const auto [orig_offset] = DuplicateLayout::decode(payload);
+                if (!selection.selected()) {
+                    break;
+                }
+                ensureCurrentDirectory();
                 // remember current position to return after copying
                 const std::streampos resume_pos = archive_in.tellg();
-                // seek to original file data
-                archive_in.seekg(orig_offset);
+                // seek to original file data, which may belong to an entry not selected itself
+                archive_in.seekg(static_cast<std::streamoff>(orig_offset));
 
-                extractFileData(archive_in, full_entry_path);
+                const auto [data_len, checksum] = extractFileDataHeader(archive_in);
+                const bool unchanged =
+                    options.update &&
+                    outputFileIsCurrent(output, entry_path, archive_in, data_len, checksum);
+                if (!unchanged) {
+                    writeOutputFile(entry_path, archive_in, data_len);
+                }
 
                 // restore read position to continue processing
                 archive_in.seekg(resume_pos);
-                std::cout << "Created duplicate file from offset " << orig_offset << std::endl;
+                if (unchanged) {
+                    log << "Unchanged duplicate file: " << entry_path << std::endl;
+                } else {
+                    log << "Created duplicate file from offset " << orig_offset << std::endl;
+                }
                 break;
             }
             case file_type::symlink: {
-                // symlink target is stored as a path (writePath)
+                // symlink target is stored as a path (appendPath)
                 fs::path target;
-                extractPath(archive_in, target);
-                std::error_code ec;
-                fs::create_symlink(target, full_entry_path, ec);
-                if (ec) {
-                    // try directory-symlink as fallback (platform dependent)
-                    fs::create_directory_symlink(target, full_entry_path, ec);
-                    if (ec) {
-                        throw std::runtime_error("Failed to create symlink \"" +
-                                                 full_entry_path.string() + "\" to \"" +
-                                                 target.string() + "\": " + ec.message());
+                extractPath(archive_in, extractSymlinkTargetLength(archive_in, payload), target);
+                if (!selection.selected()) {
+                    break;
+                }
+                ensureCurrentDirectory();
+                if (options.update) {
+                    if (output.existingSymlinkTarget(entry_path) == target) {
+                        log << "Unchanged symlink: " << entry_path << std::endl;
+                        break;
                     }
+                    output.replaceSymlink(entry_path, target);
+                } else {
+                    output.createSymlink(entry_path, target);
+                }
+                log << "Created symlink: " << entry_path << " -> " << target << std::endl;
+                break;
+            }
+            case file_type::blob_ref: {
+                const BlobKey key = decodeBlobKey(payload);
+                if (!selection.selected()) {
+                    break;
+                }
+                ensureCurrentDirectory();
+                if (options.update && outputFileIsCurrent(output, entry_path, key)) {
+                    log << "Unchanged file from blob store: " << entry_path << std::endl;
+                    break;
                 }
-                std::cout << "Created symlink: " << full_entry_path << " -> " << target
-                          << std::endl;
+                const std::unique_ptr<std::istream> blob_in = options.store->open(key);
+                writeOutputFile(entry_path, *blob_in, key.size);
+                log << "Extracted file from blob store: " << entry_path << std::endl;
+                break;
+            }
+            case file_type::delta: {
+                const DeltaHeader delta = decodeDeltaHeader(payload);
+                if (!selection.selected()) {
+                    archive_in.seekg(delta.delta_len, std::ios::cur);
+                    break;
+                }
+                ensureCurrentDirectory();
+                const std::vector<char> content = extractDeltaData(archive_in, delta);
+                if (options.update && outputFileIsCurrent(output, entry_path, content)) {
+                    log << "Unchanged delta encoded file: " << entry_path << std::endl;
+                    break;
+                }
+                SpanIStream content_in(content.data(), content.size());
+                writeOutputFile(entry_path, content_in, content.size());
+                log << "Extracted delta encoded file: " << entry_path << std::endl;
                 break;
             }
             default:
@@ -135,85 +411,398 @@ void Packer::unpack(const fs::path& archive_path, const fs::path& output_path) {
                                          std::to_string(static_cast<int>(ft)));
         }
     }
+    if (options.remove_stale) {
+        removeStaleEntries(output, fs::path(), archived_paths, extracted_directories, log);
+    }
+    output.finish();
 }
 
-// Add an entry to the archive
-void Packer::add_entry(const fs::directory_entry& entry, int path_depth) {
-    constexpr std::size_t MAX_PATH_SIZE = std::numeric_limits<std::uint16_t>::max();
+// Sizes are compared first, so that only files which may be unchanged are read. The existing
+// file is hashed with the same hasher as the archived checksum; archives without checksums get
+// their file data hashed as well.
+bool Packer::outputFileIsCurrent(const OutputTree& output, const fs::path& path,
+                                 std::istream& archive_in, std::uint32_t data_len,
+                                 StreamHasher::hash_value_t checksum) {
+    const std::optional<std::uint64_t> existing_size = output.existingFileSize(path);
+    if (!existing_size || *existing_size != data_len) {
+        return false;
+    }
+    if ((archive_flags_ & ARCHIVE_FLAG_CHECKSUMS) == 0) {
+        const std::streampos data_pos = archive_in.tellg();
+        checksum = hashStream(archive_in, data_len);
+        archive_in.seekg(data_pos);
+    }
+    const std::unique_ptr<std::istream> existing = output.openExistingFile(path);
+    return hashStream(*existing, data_len) == checksum;
+}
+
+bool Packer::outputFileIsCurrent(const OutputTree& output, const fs::path& path,
+                                 const std::vector<char>& content) {
+    const std::optional<std::uint64_t> existing_size = output.existingFileSize(path);
+    if (!existing_size || *existing_size != content.size()) {
+        return false;
+    }
+    const std::unique_ptr<std::istream> existing = output.openExistingFile(path);
+    return hashStream(*existing, content.size()) ==
+           hasher_.compute_hash(content.data(), content.size());
+}
+
+bool Packer::outputFileIsCurrent(const OutputTree& output, const fs::path& path,
+                                 const BlobKey& key) {
+    const std::optional<std::uint64_t> existing_size = output.existingFileSize(path);
+    if (!existing_size || *existing_size != key.size) {
+        return false;
+    }
+    const std::unique_ptr<std::istream> existing = output.openExistingFile(path);
+    const BufferPool::Buffer buf = buffers_.acquire(tuning_.hash_chunk_size);
+    return BlobStore::computeKey(*existing, key.size, buf.data(), buf.size()) == key;
+}
 
-    file_type file_type = from_std_fs_type(entry.symlink_status().type());
-    const fs::path relative_path = fs::relative(entry.path(), input_root_);
+void Packer::removeStaleEntries(OutputTree& output, const fs::path& directory,
+                                const std::unordered_set<std::string>& archived,
+                                const std::unordered_set<std::string>& extracted_directories,
+                                std::ostream& log) {
+    for (const std::string& name : output.listDirectory(directory)) {
+        const fs::path path = directory / name;
+        const std::string key = path.generic_string();
+        if (archived.count(key) == 0) {
+            output.removeEntry(path);
+            log << "Removed stale entry: " << path << std::endl;
+        } else if (extracted_directories.count(key) != 0) {
+            removeStaleEntries(output, path, archived, extracted_directories, log);
+        }
+    }
+}
+
+void Packer::unpack(const fs::path& archive_path, const fs::path& output_path,
+                    const UnpackOptions& options) {
+    // open archive for reading
+    ifstream_exc archive_in(archive_path, std::ios::binary);
+    if (!archive_in.is_open()) {
+        throw std::runtime_error("Failed to open archive: " + archive_path.string());
+    }
+    FsOutputTree output(output_path, options.sync, tuning_.write_chunk_size, &buffers_);
+    unpack(archive_in, output, options);
+}
+
+// Verification reads the archive strictly sequentially through a large stream buffer. File data
+// is copied out and checked by a pool of hashing workers while reading continues, large file
+// data in chunks of VERIFY_CHUNK_SIZE so that memory use stays bounded.
+bool Packer::verify(const fs::path& archive_path) {
+    std::vector<char> stream_buffer(VERIFY_STREAM_BUFFER_SIZE);
+    ifstream_exc archive_in;
+    archive_in.rdbuf()->pubsetbuf(stream_buffer.data(),
+                                  static_cast<std::streamsize>(stream_buffer.size()));
+    archive_in.open(archive_path, std::ios::binary);
+    if (!archive_in.is_open()) {
+        throw std::runtime_error("Failed to open archive: " + archive_path.string());
+    }
+    return verify(archive_in);
+}
+
+bool Packer::verify(std::istream& archive_in) {
+    // the archive size tells truncated file data apart before reading it, when it is known
+    std::uintmax_t archive_size = std::numeric_limits<std::uintmax_t>::max();
+    if (archive_in.seekg(0, std::ios::end)) {
+        archive_size = static_cast<std::uintmax_t>(archive_in.tellg());
+    }
+    archive_in.clear();
+    archive_in.seekg(0);
+    extractArchiveHeader(archive_in);
+    const bool has_checksums = (archive_flags_ & ARCHIVE_FLAG_CHECKSUMS) != 0;
+
+    HashWorkerPool hash_workers(hasher_, std::thread::hardware_concurrency(),
+                                VERIFY_MAX_BYTES_IN_FLIGHT);
+    // offsets of file data lengths, the only valid targets of duplicate entries
+    std::unordered_set<std::streamoff> data_offsets;
+    std::size_t entry_count = 0;
+    std::uint64_t data_bytes = 0;
+    int depth = 0;
+    bool structure_ok = true;
+
+    std::streamoff entry_offset = archive_in.tellg();
+    try {
+        file_type ft;
+        std::string_view entry_name;
+        const char* payload = nullptr;
+        while (extractMetadata(archive_in, ft, entry_name, payload)) {
+            ++entry_count;
+            // fixed fields following the name were read along with it
+            const std::streamoff payload_offset =
+                archive_in.tellg() - static_cast<std::streamoff>(payloadSize(ft));
+            if (ft != file_type::leave_directory && !isPlainEntryName(entry_name)) {
+                throw std::runtime_error("Invalid entry name: " + std::string(entry_name));
+            }
+
+            switch (ft) {
+                case file_type::directory:
+                    ++depth;
+                    break;
+                case file_type::leave_directory: {
+                    const auto [depth_decrease] = DepthDecreaseLayout::decode(payload);
+                    if (depth_decrease == 0 || depth_decrease > depth) {
+                        throw std::runtime_error("Invalid depth decrease " +
+                                                 std::to_string(depth_decrease) + " at depth " +
+                                                 std::to_string(depth));
+                    }
+                    depth -= depth_decrease;
+                    break;
+                }
+                case file_type::regular: {
+                    const std::streamoff data_offset = payload_offset;
+                    const auto [data_len, checksum] = decodeFileData(payload);
+                    const std::streamoff data_end = archive_in.tellg() + std::streamoff(data_len);
+                    if (static_cast<std::uintmax_t>(data_end) > archive_size) {
+                        throw std::runtime_error("File data of " + std::to_string(data_len) +
+                                                 " bytes extends past the end of the archive");
+                    }
+                    data_offsets.insert(data_offset);
+                    data_bytes += data_len;
+
+                    if (!has_checksums) {
+                        archive_in.seekg(data_end);
+                    } else if (data_len > VERIFY_CHUNK_SIZE) {
+                        // handed over in chunks, so that the workers hash while this thread
+                        // keeps reading
+                        const HashWorkerPool::StreamId stream =
+                            hash_workers.beginStream(data_offset, checksum);
+                        try {
+                            for (std::uint32_t remaining = data_len; remaining > 0;) {
+                                std::vector<char> chunk(std::min(remaining, VERIFY_CHUNK_SIZE));
+                                archive_in.read(chunk.data(),
+                                                static_cast<std::streamsize>(chunk.size()));
+                                requireGood(archive_in, "file data");
+                                remaining -= static_cast<std::uint32_t>(chunk.size());
+                                hash_workers.submitChunk(stream, std::move(chunk));
+                            }
+                        } catch (...) {
+                            hash_workers.cancelStream(stream);
+                            throw;
+                        }
+                        hash_workers.endStream(stream);
+                    } else {
+                        std::vector<char> data(data_len);
+                        archive_in.read(data.data(), data_len);
+                        requireGood(archive_in, "file data");
+                        hash_workers.submit(data_offset, checksum, std::move(data));
+                    }
+                    break;
+                }
+                case file_type::duplicate: {
+                    const std::streamoff orig_offset =
+                        std::get<0>(DuplicateLayout::decode(payload));
+                    if (data_offsets.count(orig_offset) == 0) {
+                        throw std::runtime_error("Duplicate refers to offset " +
+                                                 std::to_string(orig_offset) +
+                                                 " which is not the start of earlier file data");
+                    }
+                    break;
+                }
+                case file_type::symlink: {
+                    fs::path target;
+                    extractPath(archive_in, extractSymlinkTargetLength(archive_in, payload),
+                                target);
+                    if (target.empty()) {
+                        throw std::runtime_error("Empty symlink target");
+                    }
+                    break;
+                }
+                case file_type::blob_ref:
+                    // the data lives in the blob store, only the reference can be checked here
+                    break;
+                case file_type::delta: {
+                    const DeltaHeader delta = decodeDeltaHeader(payload);
+                    if (data_offsets.count(delta.base_offset) == 0) {
+                        throw std::runtime_error("Delta refers to offset " +
+                                                 std::to_string(delta.base_offset) +
+                                                 " which is not the start of earlier file data");
+                    }
+                    const std::streamoff delta_end =
+                        archive_in.tellg() + std::streamoff(delta.delta_len);
+                    if (static_cast<std::uintmax_t>(delta_end) > archive_size) {
+                        throw std::runtime_error("Delta of " + std::to_string(delta.delta_len) +
+                                                 " bytes extends past the end of the archive");
+                    }
+                    data_bytes += delta.delta_len;
+
+                    // applying the delta also checks that its operations stay within bounds
+                    std::vector<char> content = extractDeltaData(archive_in, delta);
+                    if (has_checksums) {
+                        hash_workers.submit(payload_offset, delta.checksum, std::move(content));
+                    }
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Unsupported file type in archive: " +
+                                             std::to_string(static_cast<int>(ft)));
+            }
+            entry_offset = archive_in.tellg();
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "Archive structure error in entry at offset " << entry_offset << ": "
+                  << e.what() << std::endl;
+        structure_ok = false;
+    }
+
+    // sorted by offset
+    const std::vector<std::streamoff> mismatches = hash_workers.finish();
+    for (std::streamoff offset : mismatches) {
+        std::cerr << "Checksum mismatch for file data at offset " << offset << std::endl;
+    }
+
+    std::cout << "Verified " << entry_count << " entries with " << data_offsets.size()
+              << " file data blocks (" << data_bytes << " bytes)"
+              << (has_checksums ? "" : ", archive has no checksums") << std::endl;
+    return structure_ok && mismatches.empty();
+}
+
+// Add an entry to the archive
+void Packer::add_entry(const InputEntry& entry) {
+    file_type file_type = entry.type;
 
     // handle directory depth decreases
-    if (path_depth != current_depth_) {
-        int depth_decrease = current_depth_ - path_depth;
+    if (entry.depth != current_depth_) {
+        int depth_decrease = current_depth_ - entry.depth;
         writeLeaveDirectory(depth_decrease);
-        current_depth_ = path_depth;
+        current_depth_ = entry.depth;
     }
 
     // for regular files, check for duplicates
     std::streamoff duplicate_offset = 0;
-    if (file_type == file_type::regular) {
-        duplicate_offset = getDuplicateFileOffset(entry.path());
+    StreamHasher::hash_value_t hash = 0;
+    std::optional<SimilarityIndex::Sketch> sketch;
+    DeltaEncoding delta;
+    // files that may be delta encoded are read once, for hashing, sketching, encoding and
+    // storing them in full if no delta is found
+    std::vector<char> content;
+    bool delta_candidate = false;
+    BlobKey blob_key;
+    if (file_type == file_type::regular && store_ != nullptr) {
+        // the store deduplicates file data across archives, including within this one; data
+        // whose key is taken by different bytes in the store is kept in the archive instead
+        if (storeFileData(entry.path, blob_key)) {
+            file_type = file_type::blob_ref;
+        } else {
+            hash = hashStream(*input_->openFile(entry.path));
+        }
+    } else if (file_type == file_type::regular) {
+        if (delta_encoding_) {
+            const std::uint64_t size = input_->fileSize(entry.path);
+            delta_candidate = size >= DELTA_MIN_FILE_SIZE && size <= DELTA_MAX_FILE_SIZE;
+        }
+        duplicate_offset =
+            getDuplicateFileOffset(entry.path, hash, delta_candidate ? &content : nullptr);
         if (duplicate_offset != 0) {
             file_type = file_type::duplicate;
+        } else if (delta_candidate) {
+            sketch = SimilarityIndex::computeSketch(content.data(), content.size());
+            delta.size = content.size();
+            if (encodeDeltaAgainstSimilarFile(content, *sketch, delta)) {
+                file_type = file_type::delta;
+            }
         }
     }
-    writeMetadata(file_type, entry.path().filename());
+    // the whole entry header is assembled first and written with a single call
+    HeaderBuffer header;
+    appendMetadata(header, file_type, entry.path.filename().native());
+    const std::streamoff data_offset =
+        archive_out_->tellp() + static_cast<std::streamoff>(header.size());
 
     switch (file_type) {
         case file_type::regular:
-            writeFileData(entry.path());
+            writeFileData(header, entry.path, hash, delta_candidate ? &content : nullptr);
             break;
         case file_type::duplicate:
-            // write the offset of the original file
-            write_le64(archive_file_, duplicate_offset);
+            // the offset of the original file
+            header.append<DuplicateLayout>(static_cast<std::uint64_t>(duplicate_offset));
+            header.writeTo(*archive_out_);
             break;
         case file_type::symlink:
-            // write the symlink target path
-            writePath(fs::read_symlink(entry.path()));
+            // the symlink target path
+            appendPath(header, input_->readSymlink(entry.path));
+            header.writeTo(*archive_out_);
+            break;
+        case file_type::blob_ref:
+            writeBlobRef(header, blob_key);
+            break;
+        case file_type::delta:
+            writeDeltaData(header, delta, hash);
             break;
         case file_type::directory:
             ++current_depth_;
             // nothing else to write for directories
+            header.writeTo(*archive_out_);
             break;
         default:
             throw std::runtime_error("Unsupported file type " +
                                      std::to_string(static_cast<int>(file_type)) +
-                                     " for packing: " + entry.path().string());
+                                     " for packing: " + entry.path.string());
     }
 
-    archive_file_.flush();
+    archive_out_->flush();
+    if (file_type == file_type::blob_ref) {
+        // only references of entries that made it into the archive are registered
+        referenced_blobs_.insert(blob_key);
+    }
+    if (file_type == file_type::regular) {
+        // duplicates can only refer to regular file data that made it into the archive
+        file_hash_to_paths_.emplace(hash, std::make_pair(entry.path, data_offset));
+    }
+    if (file_type == file_type::regular && sketch) {
+        similarity_index_.add(*sketch, {entry.path, data_offset, delta.size, hash});
+    }
 }
 
-std::streamoff Packer::getDuplicateFileOffset(const fs::path& file_path) {
+// the computed hash of the file content is returned in `hash` for use as its checksum
+std::streamoff Packer::getDuplicateFileOffset(const fs::path& file_path,
+                                              StreamHasher::hash_value_t& hash,
+                                              std::vector<char>* content) {
     // compute hash of the file
-    StreamHasher::hash_value_t hash = 0;
-    // nested scope to ensure ifstream is closed before further processing
+    // nested scope to ensure the file is closed before further processing
     {
-        packer::ifstream_exc input_file(file_path, std::ios::binary);
-        hash = hasher_.compute_hash(input_file);
+        std::unique_ptr<std::istream> input_file = input_->openFile(file_path);
+        if (content != nullptr) {
+            *content = readContent(
+                *input_file, static_cast<std::size_t>(input_->fileSize(file_path)), file_path);
+            hash = hasher_.compute_hash(content->data(), content->size());
+        } else {
+            hash = hashStream(*input_file);
+        }
     }
-    // check for duplicate by hash and content
-    std::streamoff duplicate_offset = findDuplicateFile(file_path, hash);
-    if (duplicate_offset == 0) {
-        // not a duplicate, store hash and path with offset to file content
-        auto content_offset = archive_file_.tellp();
-        // skip metadata size to get to content offset
-        content_offset += sizeof(std::uint8_t) +                // file type
-                          sizeof(std::uint16_t) +               // path length
-                          file_path.filename().string().size(); // path bytes
+    // check for duplicate by hash and content; files stored in full are registered by add_entry
+    return findDuplicateFile(file_path, hash);
+}
 
-        file_hash_to_paths_.emplace(hash, std::make_pair(file_path, content_offset));
-    }
+StreamHasher::hash_value_t Packer::hashStream(std::istream& in) {
+    const BufferPool::Buffer buf = buffers_.acquire(tuning_.hash_chunk_size);
+    const std::unique_ptr<StreamHasher::State> state = hasher_.start();
+    do {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        state->update(buf.data(), static_cast<std::size_t>(in.gcount()));
+    } while (in);
+    return state->digest();
+}
 
-    return duplicate_offset;
+StreamHasher::hash_value_t Packer::hashStream(std::istream& in, std::uint64_t length) {
+    const BufferPool::Buffer buf = buffers_.acquire(tuning_.hash_chunk_size);
+    const std::unique_ptr<StreamHasher::State> state = hasher_.start();
+    while (length > 0) {
+        const std::streamsize to_read =
+            static_cast<std::streamsize>(std::min<std::uint64_t>(length, buf.size()));
+        in.read(buf.data(), to_read);
+        if (in.gcount() != to_read) {
+            throw std::runtime_error("Unexpected EOF while hashing stream");
+        }
+        state->update(buf.data(), static_cast<std::size_t>(to_read));
+        length -= static_cast<std::uint64_t>(to_read);
+    }
+    return state->digest();
 }
 
 // check for duplicate files by hash and content
 // returns a non-zero offset of the original file content if found, 0 otherwise
 std::streamoff Packer::findDuplicateFile(const fs::path& file_path,
-                                         StreamHasher::hash_value_t& hash) const {
+                                         StreamHasher::hash_value_t& hash) {
     // check if we have seen this hash before
     const auto range = file_hash_to_paths_.equal_range(hash);
     for (auto it = range.first; it != range.second; ++it) {
@@ -230,16 +819,17 @@ std::streamoff Packer::findDuplicateFile(const fs::path& file_path,
 }
 
 // read and compare both files in chunks
-bool Packer::filesAreIdentical(const fs::path& path1, const fs::path& path2) const {
-    std::vector<char> buf1(CHUNK_SIZE);
-    std::vector<char> buf2(CHUNK_SIZE);
-    packer::ifstream_exc ifs1(path1, std::ios::binary);
-    packer::ifstream_exc ifs2(path2, std::ios::binary);
-    while (ifs1 && ifs2) {
-        ifs1.read(buf1.data(), CHUNK_SIZE);
-        ifs2.read(buf2.data(), CHUNK_SIZE);
-        std::streamsize bytes_read1 = ifs1.gcount();
-        std::streamsize bytes_read2 = ifs2.gcount();
+bool Packer::filesAreIdentical(const fs::path& path1, const fs::path& path2) {
+    const std::streamsize chunk_size = static_cast<std::streamsize>(tuning_.read_chunk_size);
+    const BufferPool::Buffer buf1 = buffers_.acquire(tuning_.read_chunk_size);
+    const BufferPool::Buffer buf2 = buffers_.acquire(tuning_.read_chunk_size);
+    std::unique_ptr<std::istream> ifs1 = input_->openFile(path1);
+    std::unique_ptr<std::istream> ifs2 = input_->openFile(path2);
+    while (*ifs1 && *ifs2) {
+        ifs1->read(buf1.data(), chunk_size);
+        ifs2->read(buf2.data(), chunk_size);
+        std::streamsize bytes_read1 = ifs1->gcount();
+        std::streamsize bytes_read2 = ifs2->gcount();
         if (bytes_read1 != bytes_read2 ||
             std::memcmp(buf1.data(), buf2.data(), static_cast<std::size_t>(bytes_read1)) != 0) {
             return false; // files differ
@@ -248,65 +838,228 @@ bool Packer::filesAreIdentical(const fs::path& path1, const fs::path& path2) con
     return true; // files are identical
 }
 
-void Packer::writeLeaveDirectory(int depth_decrease) {
-    // write the file_type::leave_directory value (cast to a byte)
-    std::uint8_t type_byte = static_cast<std::uint8_t>(file_type::leave_directory);
-    archive_file_.write(reinterpret_cast<const char*>(&type_byte), sizeof(type_byte));
-    // write the depth decrease as 16 bits little-endian
-    write_le16(archive_file_, static_cast<std::uint16_t>(depth_decrease));
+// read and compare both streams in chunks
+bool Packer::streamsAreIdentical(std::istream& in1, std::istream& in2, std::uint64_t length) {
+    const BufferPool::Buffer buf1 = buffers_.acquire(tuning_.read_chunk_size);
+    const BufferPool::Buffer buf2 = buffers_.acquire(tuning_.read_chunk_size);
+    while (length > 0) {
+        const std::streamsize to_read =
+            static_cast<std::streamsize>(std::min<std::uint64_t>(length, buf1.size()));
+        in1.read(buf1.data(), to_read);
+        in2.read(buf2.data(), to_read);
+        if (in1.gcount() != to_read || in2.gcount() != to_read ||
+            std::memcmp(buf1.data(), buf2.data(), static_cast<std::size_t>(to_read)) != 0) {
+            return false;
+        }
+        length -= static_cast<std::uint64_t>(to_read);
+    }
+    return true;
 }
 
-void Packer::writeMetadata(file_type file_type, const fs::path& file_path) {
-    constexpr std::size_t MAX_PATH_SIZE = std::numeric_limits<std::uint16_t>::max();
+void Packer::writeArchiveHeader(std::uint16_t flags) {
+    output_flags_ = flags;
+    output_names_.clear();
+    archive_out_->write(ARCHIVE_MAGIC.data(), ARCHIVE_MAGIC.size());
+    write_le16(*archive_out_, flags);
+    if (flags & ARCHIVE_FLAG_BLOB_REFS) {
+        archive_out_->write(reinterpret_cast<const char*>(archive_id_.data()),
+                            archive_id_.size());
+    }
+}
+
+void Packer::extractArchiveHeader(std::istream& archive_in) {
+    std::array<char, ARCHIVE_MAGIC.size()> magic{};
+    archive_in.read(magic.data(), magic.size());
+    if (archive_in.gcount() != static_cast<std::streamsize>(magic.size()) ||
+        magic != ARCHIVE_MAGIC) {
+        // archive written before the header was introduced, entries start right away
+        archive_in.clear();
+        archive_in.seekg(0);
+        archive_flags_ = 0;
+        input_names_.clear();
+        return;
+    }
+    archive_flags_ = read_le16(archive_in);
+    requireGood(archive_in, "archive header");
+    if ((archive_flags_ & ~ARCHIVE_KNOWN_FLAGS) != 0) {
+        throw std::runtime_error("Archive uses unsupported format flags: " +
+                                 std::to_string(archive_flags_));
+    }
+    if (archive_flags_ & ARCHIVE_FLAG_BLOB_REFS) {
+        archive_in.read(reinterpret_cast<char*>(archive_id_.data()), archive_id_.size());
+        requireGood(archive_in, "blob store archive id");
+    }
+    input_names_.clear();
+}
 
-    // write the file_type value (cast to a byte)
-    std::uint8_t type_byte = static_cast<std::uint8_t>(file_type);
-    archive_file_.write(reinterpret_cast<const char*>(&type_byte), sizeof(type_byte));
+void Packer::writeLeaveDirectory(int depth_decrease) {
+    HeaderBuffer header;
+    if (output_flags_ & ARCHIVE_FLAG_NAME_TABLE) {
+        header.append<FieldLayout<std::uint8_t>>(
+            static_cast<std::uint8_t>(file_type::leave_directory));
+        header.appendVarint(static_cast<std::uint64_t>(depth_decrease));
+    } else {
+        header.append<EntryPrefixLayout>(static_cast<std::uint8_t>(file_type::leave_directory),
+                                         static_cast<std::uint16_t>(depth_decrease));
+    }
+    header.writeTo(*archive_out_);
+}
 
-    writePath(file_path);
+void Packer::appendMetadata(HeaderBuffer& header, file_type file_type,
+                            std::string_view entry_name) {
+    header.append<FieldLayout<std::uint8_t>>(static_cast<std::uint8_t>(file_type));
+    if ((output_flags_ & ARCHIVE_FLAG_NAME_TABLE) == 0) {
+        appendPath(header, fs::path(entry_name));
+        return;
+    }
+    if (const std::optional<std::uint32_t> id = output_names_.find(entry_name)) {
+        header.appendVarint(static_cast<std::uint64_t>(*id) << 1 | 1);
+        return;
+    }
+    if (entry_name.size() > std::numeric_limits<std::uint16_t>::max()) {
+        throw std::range_error("Path too long to store in archive: " + std::string(entry_name));
+    }
+    header.appendVarint(static_cast<std::uint64_t>(entry_name.size()) << 1);
+    header.appendBytes(entry_name);
+    output_names_.add(entry_name, true);
 }
 
-bool Packer::extractMetadata(std::istream& archive_in, file_type& ft, fs::path& entry_name) {
-    // read file_type byte
-    std::uint8_t type_byte = 0;
-    archive_in.read(reinterpret_cast<char*>(&type_byte), sizeof(type_byte));
-    if (archive_in.eof()) {
+// The entry prefix is read first, then the name together with the fixed fields following it,
+// so that an entry header costs two reads regardless of its type.
+bool Packer::extractMetadata(std::istream& archive_in, file_type& ft,
+                             std::string_view& entry_name, const char*& payload) {
+    if (archive_flags_ & ARCHIVE_FLAG_NAME_TABLE) {
+        return extractNameTableMetadata(archive_in, ft, entry_name, payload);
+    }
+    std::array<char, EntryPrefixLayout::SIZE> prefix;
+    archive_in.read(prefix.data(), prefix.size());
+    if (archive_in.gcount() == 0 && archive_in.eof()) {
         return false; // reached end of archive
     }
-    if (archive_in.gcount() != sizeof(type_byte)) {
-        throw std::runtime_error("Unexpected EOF while reading file type from archive");
+    if (archive_in.gcount() != static_cast<std::streamsize>(prefix.size())) {
+        throw std::runtime_error("Unexpected EOF while reading entry header from archive");
     }
+    const auto [type_byte, name_length] = EntryPrefixLayout::decode(prefix.data());
     ft = static_cast<file_type>(type_byte);
 
-    if (ft != file_type::leave_directory) {
-        // read filename (path fragment) written by writePath
-        extractPath(archive_in, entry_name);
-        if (entry_name.empty()) {
-            throw std::runtime_error("Archive format error: empty file name");
+    if (ft == file_type::leave_directory) {
+        // the second prefix field is the depth decrease
+        entry_buffer_.assign(prefix.begin() + 1, prefix.end());
+        entry_name = std::string_view();
+        payload = entry_buffer_.data();
+        return true;
+    }
+
+    const std::size_t payload_size = payloadSize(ft);
+    entry_buffer_.resize(name_length + payload_size);
+    archive_in.read(entry_buffer_.data(), static_cast<std::streamsize>(entry_buffer_.size()));
+    if (archive_in.gcount() != static_cast<std::streamsize>(entry_buffer_.size())) {
+        throw std::runtime_error("Unexpected EOF while reading entry header from archive");
+    }
+    if (name_length == 0) {
+        throw std::runtime_error("Archive format error: empty file name");
+    }
+    entry_name = std::string_view(entry_buffer_.data(), name_length);
+    payload = entry_buffer_.data() + name_length;
+    return true;
+}
+
+// Same as the fixed-width prefix, except that the name is either read into the table or
+// resolved from it. Payloads are handed out in the same form, a leave_directory entry's varint
+// depth decrease is stored as DepthDecreaseLayout.
+bool Packer::extractNameTableMetadata(std::istream& archive_in, file_type& ft,
+                                      std::string_view& entry_name, const char*& payload) {
+    constexpr std::uint64_t MAX_FIELD_VALUE = std::numeric_limits<std::uint16_t>::max();
+
+    const std::istream::int_type type_byte = archive_in.get();
+    if (type_byte == std::istream::traits_type::eof()) {
+        return false; // reached end of archive
+    }
+    ft = static_cast<file_type>(type_byte);
+
+    if (ft == file_type::leave_directory) {
+        const std::uint64_t depth_decrease = readVarint(archive_in, "entry header");
+        if (depth_decrease > MAX_FIELD_VALUE) {
+            throw std::runtime_error("Archive format error: depth decrease out of range");
         }
+        entry_buffer_.resize(DepthDecreaseLayout::SIZE);
+        DepthDecreaseLayout::encode(entry_buffer_.data(),
+                                    static_cast<std::uint16_t>(depth_decrease));
+        entry_name = std::string_view();
+        payload = entry_buffer_.data();
+        return true;
+    }
+
+    // (length << 1) for a name stored inline, (id << 1 | 1) for a name seen before
+    const std::uint64_t name_code = readVarint(archive_in, "entry header");
+    const bool is_reference = (name_code & 1) != 0;
+    const std::uint64_t name_length = is_reference ? 0 : name_code >> 1;
+    if (!is_reference && (name_length == 0 || name_length > MAX_FIELD_VALUE)) {
+        throw std::runtime_error("Archive format error: invalid file name length");
     }
+    entry_buffer_.resize(static_cast<std::size_t>(name_length) + payloadSize(ft));
+    archive_in.read(entry_buffer_.data(), static_cast<std::streamsize>(entry_buffer_.size()));
+    if (archive_in.gcount() != static_cast<std::streamsize>(entry_buffer_.size())) {
+        throw std::runtime_error("Unexpected EOF while reading entry header from archive");
+    }
+    entry_name = is_reference ? input_names_.get(name_code >> 1)
+                              : input_names_.add(std::string_view(
+                                    entry_buffer_.data(), static_cast<std::size_t>(name_length)));
+    payload = entry_buffer_.data() + name_length;
     return true;
 }
 
-// write a file path to the archive
-void Packer::writePath(const fs::path& file_path) {
+std::uint16_t Packer::extractSymlinkTargetLength(std::istream& archive_in, const char* payload) {
+    if ((archive_flags_ & ARCHIVE_FLAG_NAME_TABLE) == 0) {
+        return std::get<0>(SymlinkLayout::decode(payload));
+    }
+    const std::uint64_t length = readVarint(archive_in, "symlink target length");
+    if (length > std::numeric_limits<std::uint16_t>::max()) {
+        throw std::runtime_error("Archive format error: symlink target too long");
+    }
+    return static_cast<std::uint16_t>(length);
+}
+
+std::size_t Packer::payloadSize(file_type ft) const {
+    const bool has_checksums = (archive_flags_ & ARCHIVE_FLAG_CHECKSUMS) != 0;
+    switch (ft) {
+        case file_type::regular:
+            return has_checksums ? FileDataLayout::SIZE : LegacyFileDataLayout::SIZE;
+        case file_type::duplicate:
+            return DuplicateLayout::SIZE;
+        case file_type::symlink:
+            // the target length is a varint read separately in archives with a name table
+            return (archive_flags_ & ARCHIVE_FLAG_NAME_TABLE) ? 0 : SymlinkLayout::SIZE;
+        case file_type::blob_ref:
+            return BlobRefLayout::SIZE;
+        case file_type::delta:
+            return has_checksums ? DeltaLayout::SIZE : LegacyDeltaLayout::SIZE;
+        default:
+            // directories have no fields, unknown types are rejected by the caller
+            return 0;
+    }
+}
+
+// append a file path as [2 bytes: length][path bytes], or [varint length][path bytes] in
+// archives with a name table
+void Packer::appendPath(HeaderBuffer& header, const fs::path& file_path) {
     constexpr std::size_t MAX_PATH_SIZE = std::numeric_limits<std::uint16_t>::max();
 
     const std::string file_path_str = file_path.string();
     if (file_path_str.size() > MAX_PATH_SIZE) {
         throw std::range_error("Path too long to store in archive: " + file_path.string());
     }
-    std::uint16_t path_length = static_cast<std::uint16_t>(file_path_str.size());
-    // write length of path on 16 bits little-endian
-    write_le16(archive_file_, path_length);
-    // write path bytes
-    archive_file_.write(file_path_str.data(), file_path_str.size());
+    if (output_flags_ & ARCHIVE_FLAG_NAME_TABLE) {
+        header.appendVarint(file_path_str.size());
+    } else {
+        header.append<FieldLayout<std::uint16_t>>(
+            static_cast<std::uint16_t>(file_path_str.size()));
+    }
+    header.appendBytes(file_path_str);
 }
 
-void Packer::extractPath(std::istream& archive_in, fs::path& out_path) {
-    // read length of path
-    std::streamsize path_length = read_le16(archive_in);
-    // read path bytes
+void Packer::extractPath(std::istream& archive_in, std::uint16_t path_length,
+                         fs::path& out_path) {
     std::string path_str;
     path_str.resize(path_length);
     archive_in.read(path_str.data(), path_length);
@@ -316,58 +1069,335 @@ void Packer::extractPath(std::istream& archive_in, fs::path& out_path) {
     out_path = fs::path(path_str);
 }
 
-// write the contents of a regular file to the archive
-void Packer::writeFileData(const fs::path& file_path) {
+// write the header followed by the contents of a regular file to the archive
+void Packer::writeFileData(HeaderBuffer& header, const fs::path& file_path,
+                           StreamHasher::hash_value_t checksum,
+                           const std::vector<char>* content) {
     constexpr std::size_t MAX_FILE_SIZE = std::numeric_limits<std::uint32_t>::max();
 
-    auto file_size = fs::file_size(file_path);
+    auto file_size = content != nullptr ? content->size() : input_->fileSize(file_path);
     // check for file size not fitting 32 bits
     if (file_size > MAX_FILE_SIZE) {
         throw std::range_error("File of size " + std::to_string(file_size) +
                                " too large to store in archive: " + file_path.string());
     }
     std::uint32_t data_len = static_cast<std::uint32_t>(file_size);
-    packer::write_le32(archive_file_, data_len);
+    header.append<FileDataLayout>(data_len, checksum);
+    header.writeTo(*archive_out_);
 
+    if (content != nullptr) {
+        archive_out_->write(content->data(), static_cast<std::streamsize>(data_len));
+        return;
+    }
     // stream file contents into the archive (if any)
     if (data_len > 0) {
-        packer::ifstream_exc input_file(file_path, std::ios::binary);
+        std::unique_ptr<std::istream> input_file = input_->openFile(file_path);
 
-        std::vector<char> buf(CHUNK_SIZE);
+        const BufferPool::Buffer buf = buffers_.acquire(tuning_.read_chunk_size);
         std::streamsize remaining = data_len;
         while (remaining > 0) {
-            std::streamsize to_read = std::min(remaining, CHUNK_SIZE);
-            input_file.read(buf.data(), to_read);
-            if (input_file.gcount() != to_read) {
+            std::streamsize to_read =
+                std::min(remaining, static_cast<std::streamsize>(buf.size()));
+            input_file->read(buf.data(), to_read);
+            if (input_file->gcount() != to_read) {
                 throw std::runtime_error("Unexpected EOF while reading file: " +
                                          file_path.string());
             }
-            archive_file_.write(buf.data(), to_read);
+            archive_out_->write(buf.data(), to_read);
             remaining -= to_read;
         }
     }
 }
 
-void Packer::extractFileData(std::istream& archive_in, const fs::path& out_path) {
-    std::ofstream out;
-    out.exceptions(std::ios::failbit | std::ios::badbit);
-    out.open(out_path, std::ios::binary);
+std::pair<std::uint32_t, StreamHasher::hash_value_t>
+Packer::decodeFileData(const char* payload) const {
+    if (archive_flags_ & ARCHIVE_FLAG_CHECKSUMS) {
+        const auto [data_len, checksum] = FileDataLayout::decode(payload);
+        return {data_len, checksum};
+    }
+    return {std::get<0>(LegacyFileDataLayout::decode(payload)), 0};
+}
+
+std::pair<std::uint32_t, StreamHasher::hash_value_t>
+Packer::extractFileDataHeader(std::istream& archive_in) {
+    std::array<char, FileDataLayout::SIZE> fields;
+    const std::streamsize size =
+        static_cast<std::streamsize>(payloadSize(file_type::regular));
+    archive_in.read(fields.data(), size);
+    if (archive_in.gcount() != size) {
+        throw std::runtime_error("Unexpected EOF while reading file data length from archive");
+    }
+    return decodeFileData(fields.data());
+}
+
+// Like duplicates within an archive, a blob already in the store is only referred to after
+// comparing its bytes, the key alone does not rule out a collision.
+bool Packer::storeFileData(const fs::path& file_path, BlobKey& key) {
+    {
+        std::unique_ptr<std::istream> input_file = input_->openFile(file_path);
+        const BufferPool::Buffer buf = buffers_.acquire(tuning_.read_chunk_size);
+        key = BlobStore::computeKey(*input_file, input_->fileSize(file_path), buf.data(),
+                                    buf.size());
+    }
+    std::unique_ptr<std::istream> input_file = input_->openFile(file_path);
+    if (!store_->contains(key)) {
+        store_->put(key, *input_file);
+        return true;
+    }
+    const std::unique_ptr<std::istream> blob_in = store_->open(key);
+    return streamsAreIdentical(*input_file, *blob_in, key.size);
+}
 
-    // read length of file data
-    const std::uint32_t data_len = packer::read_le32(archive_in);
-    // read file data in chunks
-    std::vector<char> buf(CHUNK_SIZE);
-    std::streamsize remaining = data_len;
-    while (remaining > 0) {
-        std::streamsize to_read = std::min(remaining, CHUNK_SIZE);
-        archive_in.read(buf.data(), to_read);
-        if (archive_in.gcount() != to_read) {
-            throw std::runtime_error("Unexpected EOF while extracting file: " + out_path.string());
+void Packer::writeBlobRef(HeaderBuffer& header, const BlobKey& key) {
+    header.append<BlobRefLayout>(key.hash_low, key.hash_high, key.size);
+    header.writeTo(*archive_out_);
+}
+
+BlobKey Packer::decodeBlobKey(const char* payload) {
+    const auto [hash_low, hash_high, size] = BlobRefLayout::decode(payload);
+    return BlobKey{hash_low, hash_high, size};
+}
+
+BlobKeySet Packer::collectBlobReferences(std::istream& archive_in) {
+    BlobKeySet keys;
+    file_type ft;
+    std::string_view entry_name;
+    const char* payload = nullptr;
+    while (extractMetadata(archive_in, ft, entry_name, payload)) {
+        switch (ft) {
+            case file_type::directory:
+            case file_type::leave_directory:
+            case file_type::duplicate:
+                break;
+            case file_type::regular:
+                archive_in.seekg(decodeFileData(payload).first, std::ios::cur);
+                break;
+            case file_type::symlink:
+                archive_in.seekg(extractSymlinkTargetLength(archive_in, payload), std::ios::cur);
+                break;
+            case file_type::blob_ref:
+                keys.insert(decodeBlobKey(payload));
+                break;
+            case file_type::delta:
+                archive_in.seekg(decodeDeltaHeader(payload).delta_len, std::ios::cur);
+                break;
+            default:
+                throw std::runtime_error("Unsupported file type in archive: " +
+                                         std::to_string(static_cast<int>(ft)));
+        }
+    }
+    return keys;
+}
+
+bool Packer::releaseArchive(const fs::path& archive_path, BlobStore& store) {
+    ifstream_exc archive_in(archive_path, std::ios::binary);
+    if (!archive_in.is_open()) {
+        throw std::runtime_error("Failed to open archive: " + archive_path.string());
+    }
+    return releaseArchive(archive_in, store);
+}
+
+bool Packer::releaseArchive(std::istream& archive_in, BlobStore& store) {
+    extractArchiveHeader(archive_in);
+    if ((archive_flags_ & ARCHIVE_FLAG_BLOB_REFS) == 0) {
+        throw std::runtime_error("Archive was not packed against a blob store");
+    }
+    const ArchiveId archive_id = archive_id_;
+    const BlobKeySet keys = collectBlobReferences(archive_in);
+    const bool released = store.releaseArchive(archive_id, keys);
+    store.save();
+    return released;
+}
+
+void Packer::exportArchive(const fs::path& archive_path, BlobStore& store,
+                           const fs::path& output_path) {
+    ifstream_exc archive_in(archive_path, std::ios::binary);
+    if (!archive_in.is_open()) {
+        throw std::runtime_error("Failed to open archive: " + archive_path.string());
+    }
+    std::ofstream archive_file;
+    archive_file.exceptions(std::ios::failbit | std::ios::badbit);
+    archive_file.open(output_path, std::ios::binary);
+    exportArchive(archive_in, store, archive_file);
+    archive_file.close();
+}
+
+// Entries are copied one by one; directories, symlinks and names stay as they are, so only
+// blob references change their encoding.
+void Packer::exportArchive(std::istream& archive_in, BlobStore& store,
+                           std::ostream& archive_out) {
+    constexpr std::uint64_t MAX_FILE_SIZE = std::numeric_limits<std::uint32_t>::max();
+
+    ExceptionMaskGuard exception_guard(archive_out, std::ios::failbit | std::ios::badbit);
+    extractArchiveHeader(archive_in);
+    if ((archive_flags_ & ARCHIVE_FLAG_BLOB_REFS) == 0) {
+        throw std::runtime_error("Archive was not packed against a blob store");
+    }
+    archive_out_ = &archive_out;
+    writeArchiveHeader(ARCHIVE_FLAG_CHECKSUMS | (archive_flags_ & ARCHIVE_FLAG_NAME_TABLE));
+
+    // offsets of the file data of blobs exported so far, targets for duplicate entries
+    std::unordered_map<BlobKey, std::streamoff, BlobKeyHash> exported_blobs;
+    const BufferPool::Buffer buf = buffers_.acquire(tuning_.read_chunk_size);
+    file_type ft;
+    std::string_view entry_name;
+    const char* payload = nullptr;
+    while (extractMetadata(archive_in, ft, entry_name, payload)) {
+        HeaderBuffer header;
+        switch (ft) {
+            case file_type::directory:
+                appendMetadata(header, ft, entry_name);
+                header.writeTo(archive_out);
+                break;
+            case file_type::leave_directory:
+                writeLeaveDirectory(std::get<0>(DepthDecreaseLayout::decode(payload)));
+                break;
+            case file_type::symlink: {
+                fs::path target;
+                extractPath(archive_in, extractSymlinkTargetLength(archive_in, payload), target);
+                appendMetadata(header, ft, entry_name);
+                appendPath(header, target);
+                header.writeTo(archive_out);
+                break;
+            }
+            case file_type::blob_ref: {
+                const BlobKey key = decodeBlobKey(payload);
+                const auto it = exported_blobs.find(key);
+                if (it != exported_blobs.end()) {
+                    appendMetadata(header, file_type::duplicate, entry_name);
+                    header.append<DuplicateLayout>(static_cast<std::uint64_t>(it->second));
+                    header.writeTo(archive_out);
+                    break;
+                }
+                if (key.size > MAX_FILE_SIZE) {
+                    throw std::range_error("File of size " + std::to_string(key.size) +
+                                           " too large to store in archive: " +
+                                           std::string(entry_name));
+                }
+                appendMetadata(header, file_type::regular, entry_name);
+                exported_blobs.emplace(key, archive_out.tellp() +
+                                                static_cast<std::streamoff>(header.size()));
+
+                StreamHasher::hash_value_t checksum = 0;
+                {
+                    const std::unique_ptr<std::istream> blob_in = store.open(key);
+                    checksum = hashStream(*blob_in, key.size);
+                }
+                header.append<FileDataLayout>(static_cast<std::uint32_t>(key.size), checksum);
+                header.writeTo(archive_out);
+
+                const std::unique_ptr<std::istream> blob_in = store.open(key);
+                copyData(*blob_in, archive_out, key.size, buf, entry_name);
+                break;
+            }
+            case file_type::regular: {
+                // data that collided with a different blob of the store was kept in the archive
+                const auto [data_len, checksum] = decodeFileData(payload);
+                appendMetadata(header, ft, entry_name);
+                header.append<FileDataLayout>(data_len, checksum);
+                header.writeTo(archive_out);
+                copyData(archive_in, archive_out, data_len, buf, entry_name);
+                break;
+            }
+            default:
+                throw std::runtime_error("Unsupported file type in archive: " +
+                                         std::to_string(static_cast<int>(ft)));
         }
-        out.write(buf.data(), to_read);
-        remaining -= to_read;
     }
-    out.close();
+    archive_out.flush();
+}
+
+// Candidate bases are read again from the input tree; a base whose content no longer matches
+// the checksum it was archived with is skipped, as the delta is applied to the archived data.
+// Only candidates sharing most sketch components and of a comparable size are read at all.
+bool Packer::encodeDeltaAgainstSimilarFile(const std::vector<char>& content,
+                                           const SimilarityIndex::Sketch& sketch,
+                                           DeltaEncoding& encoding) {
+    delta_input_bytes_ += content.size();
+    bool found = false;
+    std::vector<char> delta;
+    for (const SimilarityIndex::Entry& base_entry :
+         similarity_index_.find(sketch, DELTA_MAX_CANDIDATES, DELTA_MIN_SHARED_COMPONENTS)) {
+        // a base far smaller or larger than the file rarely yields a delta worth reading it for
+        if (base_entry.size < content.size() / 4 || base_entry.size / 4 > content.size()) {
+            continue;
+        }
+        const std::uint64_t work = base_entry.size + content.size();
+        if (delta_work_bytes_ + work >
+            DELTA_WORK_RATIO * delta_input_bytes_ + DELTA_WORK_ALLOWANCE) {
+            break;
+        }
+        delta_work_bytes_ += work;
+
+        std::vector<char> base;
+        try {
+            if (input_->fileSize(base_entry.path) != base_entry.size) {
+                continue;
+            }
+            base = readContent(*input_->openFile(base_entry.path),
+                               static_cast<std::size_t>(base_entry.size), base_entry.path);
+        } catch (const std::runtime_error&) {
+            continue; // the base went away, the file can still be stored in full
+        }
+        if (hasher_.compute_hash(base.data(), base.size()) != base_entry.hash) {
+            continue;
+        }
+        // a later candidate has to beat the best delta so far
+        const std::size_t max_delta_size =
+            found ? encoding.data.size() - 1 : content.size() / 2;
+        if (encodeDelta(base.data(), base.size(), content.data(), content.size(),
+                        max_delta_size, delta)) {
+            encoding.base_offset = base_entry.data_offset;
+            encoding.data.swap(delta);
+            found = true;
+        }
+    }
+    return found;
+}
+
+void Packer::writeDeltaData(HeaderBuffer& header, const DeltaEncoding& encoding,
+                            StreamHasher::hash_value_t checksum) {
+    header.append<DeltaLayout>(static_cast<std::uint64_t>(encoding.base_offset),
+                               static_cast<std::uint32_t>(encoding.size), checksum,
+                               static_cast<std::uint32_t>(encoding.data.size()));
+    header.writeTo(*archive_out_);
+    archive_out_->write(encoding.data.data(), encoding.data.size());
+}
+
+Packer::DeltaHeader Packer::decodeDeltaHeader(const char* payload) const {
+    DeltaHeader delta;
+    if (archive_flags_ & ARCHIVE_FLAG_CHECKSUMS) {
+        std::tie(delta.base_offset, delta.size, delta.checksum, delta.delta_len) =
+            DeltaLayout::decode(payload);
+    } else {
+        std::tie(delta.base_offset, delta.size, delta.delta_len) =
+            LegacyDeltaLayout::decode(payload);
+    }
+    return delta;
+}
+
+std::vector<char> Packer::extractDeltaData(std::istream& archive_in, const DeltaHeader& header) {
+    if (header.delta_len > header.size) {
+        throw std::runtime_error("Invalid delta length " + std::to_string(header.delta_len));
+    }
+    std::vector<char> delta(header.delta_len);
+    archive_in.read(delta.data(), header.delta_len);
+    requireGood(archive_in, "delta");
+
+    const std::vector<char> base =
+        readFileDataAt(archive_in, static_cast<std::streamoff>(header.base_offset));
+    return applyDelta(base.data(), base.size(), delta.data(), delta.size(), header.size);
+}
+
+std::vector<char> Packer::readFileDataAt(std::istream& archive_in, std::streamoff data_offset) {
+    const std::streampos resume_pos = archive_in.tellg();
+    archive_in.seekg(data_offset);
+    const std::uint32_t data_len = extractFileDataHeader(archive_in).first;
+    std::vector<char> data(data_len);
+    archive_in.read(data.data(), data_len);
+    requireGood(archive_in, "file data");
+    archive_in.seekg(resume_pos);
+    return data;
 }
 
-} // namespace packer
\ No newline at end of file
+} // namespace packer
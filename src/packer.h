@@ -1,55 +1,264 @@
 #pragma once
 
+#include "blobstore.h"
+#include "bufferpool.h"
+#include "entryheader.h"
 #include "filetype.h"
-#include "ifstream_exc.h"
+#include "fsoutputtree.h"
+#include "inputtree.h"
+#include "iotuning.h"
+#include "nametable.h"
+#include "outputtree.h"
+#include "similarityindex.h"
 #include "streamhasher.h"
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <istream>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace packer {
 
 namespace fs = std::filesystem;
 
+// options controlling how an archive is created
+struct PackOptions {
+    // When packing a directory given by path: visit each directory's regular files in inode order
+    // and give the kernel readahead hints, see FsInputTree.
+    bool locality_order = false;
+    // When packing a directory given by path: pack only these paths relative to it, together
+    // with their parent directories, instead of walking the whole directory; see
+    // FileListInputTree. Locality order does not apply to a file list.
+    std::optional<std::vector<fs::path>> file_list;
+    // Store file data in this blob store instead of the archive. The archive then holds blob_ref
+    // entries only and is registered in the store, which is saved once packing is done.
+    BlobStore* store = nullptr;
+    // Store files similar to an earlier file of the archive as a delta against it. Candidates
+    // are found through a SimilarityIndex sketch computed from the bytes read for duplicate
+    // detection; only close candidates are read, within a work budget proportional to the
+    // input. Not used together with a blob store.
+    bool delta_encoding = false;
+    // Intern entry names in a string table so that repeated names (index.js, LICENSE, ...) are
+    // stored once and referred to by id, see ARCHIVE_FLAG_NAME_TABLE.
+    bool name_table = false;
+};
+
+// options controlling how an archive is extracted
+struct UnpackOptions {
+    // glob patterns selecting the entries to extract, see PathFilter for the matching rules;
+    // all entries are extracted when both lists are empty
+    std::vector<std::string> include_patterns;
+    std::vector<std::string> exclude_patterns;
+    // report every extracted entry on standard output
+    bool verbose = false;
+    // When unpacking into a directory given by path: how extracted data is made durable,
+    // see FsOutputTree.
+    sync_mode sync = sync_mode::none;
+    // blob store holding the file data of archives packed against a store
+    BlobStore* store = nullptr;
+    // Extract over existing content: files whose size and content hash already match the
+    // archive, and symlinks with the right target, are left untouched; other entries are
+    // replaced through OutputTree::replaceFile, replaceSymlink and replaceDirectory.
+    bool update = false;
+    // With `update`: remove entries of the output that are not in the archive. Only directories
+    // extracted from the archive are cleaned up; entries not selected by the filter are kept.
+    bool remove_stale = false;
+};
+
 // Packer class for creating and extracting packed archives
+//
+// Archives are written to and read from standard streams, so besides archive files they can live
+// in memory or be passed to a callback through the stream buffers in archivestreams.h. Archive
+// streams must start at position 0 and be seekable; see InputTree and OutputTree for the trees
+// packed from and unpacked into.
 class Packer {
   public:
-    // constructor taking a path to the archive file
-    Packer(const StreamHasher& stream_hasher);
-    ~Packer();
+    // constructor taking the hasher used for duplicate detection and checksums and the chunk
+    // sizes of file I/O
+    Packer(const StreamHasher& stream_hasher, const IoTuning& tuning = {});
+
+    // method to create an archive from an input tree
+    void pack(InputTree& input, std::ostream& archive_out, const PackOptions& options = {});
+    // method to create an archive file from input path
+    void pack(const fs::path& input_path, const fs::path& archive_path,
+              const PackOptions& options = {});
+    // method to extract all entries from the archive into an output tree
+    void unpack(std::istream& archive_in, OutputTree& output, const UnpackOptions& options = {});
+    // method to extract all entries from the archive file into output path
+    void unpack(const fs::path& archive_path, const fs::path& output_path,
+                const UnpackOptions& options = {});
+    // method to check archive structure and file data checksums without extracting anything,
+    // reports problems on standard error and returns true if the archive is intact
+    bool verify(std::istream& archive_in);
+    bool verify(const fs::path& archive_path);
 
-    // method to create an archive from input path
-    void pack(const fs::path& input_path, const fs::path& archive_path);
-    // method to extract all entries from the archive
-    void unpack(const fs::path& archive_path, const fs::path& output_path);
+    // method to write a self-contained copy of an archive packed against a blob store, with the
+    // referenced blobs stored as regular file data; blobs referenced more than once become
+    // duplicate entries
+    void exportArchive(std::istream& archive_in, BlobStore& store, std::ostream& archive_out);
+    void exportArchive(const fs::path& archive_path, BlobStore& store,
+                       const fs::path& output_path);
+    // method to drop the references of an archive packed against a blob store, so that blobs
+    // no longer used by any archive are removed by BlobStore::collectGarbage; saves the store
+    // and returns false if the archive was not registered
+    bool releaseArchive(std::istream& archive_in, BlobStore& store);
+    bool releaseArchive(const fs::path& archive_path, BlobStore& store);
 
   private:
-    static constexpr std::streamsize CHUNK_SIZE = 64 * 1024;
+    // read buffer of the archive stream when verifying
+    static constexpr std::size_t VERIFY_STREAM_BUFFER_SIZE = 4 * 1024 * 1024;
+    // file data larger than this is handed over to the hashing workers in chunks of this size
+    // when verifying, smaller file data in one piece
+    static constexpr std::uint32_t VERIFY_CHUNK_SIZE = 8 * 1024 * 1024;
+    // upper bound of file data queued for the hashing workers when verifying
+    static constexpr std::size_t VERIFY_MAX_BYTES_IN_FLIGHT = 64 * 1024 * 1024;
+    // files considered for delta encoding, both the file and its base are held in memory
+    static constexpr std::uint64_t DELTA_MIN_FILE_SIZE = 256;
+    static constexpr std::uint64_t DELTA_MAX_FILE_SIZE = 16 * 1024 * 1024;
+    // similar files tried as a base before storing a file in full
+    static constexpr std::size_t DELTA_MAX_CANDIDATES = 2;
+    // bases are only read for candidates sharing at least this many sketch components
+    static constexpr std::size_t DELTA_MIN_SHARED_COMPONENTS = SimilarityIndex::SKETCH_SIZE / 2;
+    // Bytes of bases and files run through encodeDelta per pack are limited to DELTA_WORK_RATIO
+    // times the bytes of the files considered for delta encoding plus DELTA_WORK_ALLOWANCE;
+    // once used up, further files are stored in full.
+    static constexpr std::uint64_t DELTA_WORK_RATIO = 2;
+    static constexpr std::uint64_t DELTA_WORK_ALLOWANCE = 64 * 1024 * 1024;
 
+    // add an entry, rolling the archive back to the previous entry on error
+    bool tryAddEntry(const InputEntry& entry);
     // method to add an entry to the archive
-    void add_entry(const fs::directory_entry& entry, int path_depth);
+    void add_entry(const InputEntry& entry);
 
-    std::streamoff getDuplicateFileOffset(const fs::path& file_path);
+    // the file content is read into `content` on the way when given
+    std::streamoff getDuplicateFileOffset(const fs::path& file_path,
+                                          StreamHasher::hash_value_t& hash,
+                                          std::vector<char>* content = nullptr);
     std::streamoff findDuplicateFile(const fs::path& file_path,
-                                     StreamHasher::hash_value_t& hash) const;
-    bool filesAreIdentical(const fs::path& path1, const fs::path& path2) const;
+                                     StreamHasher::hash_value_t& hash);
+    bool filesAreIdentical(const fs::path& path1, const fs::path& path2);
+    // true if the next `length` bytes of both streams are equal
+    bool streamsAreIdentical(std::istream& in1, std::istream& in2, std::uint64_t length);
+    // hash a stream to its end, or exactly `length` bytes of it, through a pooled buffer of
+    // IoTuning::hash_chunk_size bytes
+    StreamHasher::hash_value_t hashStream(std::istream& in);
+    StreamHasher::hash_value_t hashStream(std::istream& in, std::uint64_t length);
+
+    struct DeltaEncoding {
+        // offset of the base file data in the archive
+        std::streamoff base_offset = 0;
+        // size of the encoded file
+        std::uint64_t size = 0;
+        std::vector<char> data;
+    };
+    // encode file content against a similar earlier file, returning false if no base yields a
+    // delta of at most half the file size or the delta work budget is used up
+    bool encodeDeltaAgainstSimilarFile(const std::vector<char>& content,
+                                       const SimilarityIndex::Sketch& sketch,
+                                       DeltaEncoding& encoding);
+    void writeDeltaData(HeaderBuffer& header, const DeltaEncoding& encoding,
+                        StreamHasher::hash_value_t checksum);
+    struct DeltaHeader {
+        std::uint64_t base_offset = 0;
+        std::uint32_t size = 0;
+        StreamHasher::hash_value_t checksum = 0;
+        std::uint32_t delta_len = 0;
+    };
+    DeltaHeader decodeDeltaHeader(const char* payload) const;
+    // true if the output already holds `data_len` bytes of file data equal to those at the
+    // current archive position, which is left unchanged
+    bool outputFileIsCurrent(const OutputTree& output, const fs::path& path,
+                             std::istream& archive_in, std::uint32_t data_len,
+                             StreamHasher::hash_value_t checksum);
+    bool outputFileIsCurrent(const OutputTree& output, const fs::path& path,
+                             const std::vector<char>& content);
+    bool outputFileIsCurrent(const OutputTree& output, const fs::path& path, const BlobKey& key);
+    // remove the entries of an output directory that are not in `archived`, descending into
+    // `extracted_directories`; both hold generic paths relative to the root
+    void removeStaleEntries(OutputTree& output, const fs::path& directory,
+                            const std::unordered_set<std::string>& archived,
+                            const std::unordered_set<std::string>& extracted_directories,
+                            std::ostream& log);
+
+    // rebuild a delta entry's file content from the delta following its header
+    std::vector<char> extractDeltaData(std::istream& archive_in, const DeltaHeader& header);
+    // read the file data stored at `data_offset`, restoring the read position afterwards
+    std::vector<char> readFileDataAt(std::istream& archive_in, std::streamoff data_offset);
+
+    void writeArchiveHeader(std::uint16_t flags);
+    void extractArchiveHeader(std::istream& archive_in);
 
     void writeLeaveDirectory(int depth_decrease);
 
-    void writeMetadata(file_type file_type, const fs::path& file_path);
-    bool extractMetadata(std::istream& archive_in, file_type& ft, fs::path& entry_name);
+    // start an entry header with the file type and entry name
+    void appendMetadata(HeaderBuffer& header, file_type file_type, std::string_view entry_name);
+    // read an entry header; `entry_name` and `payload`, which points to the fixed fields
+    // following the entry name or to the depth decrease of leave_directory entries, stay valid
+    // until the next call
+    bool extractMetadata(std::istream& archive_in, file_type& ft, std::string_view& entry_name,
+                         const char*& payload);
+    bool extractNameTableMetadata(std::istream& archive_in, file_type& ft,
+                                  std::string_view& entry_name, const char*& payload);
+    // length of the target following a symlink entry header
+    std::uint16_t extractSymlinkTargetLength(std::istream& archive_in, const char* payload);
+    // size of the fixed fields following the name of an entry of the given type
+    std::size_t payloadSize(file_type ft) const;
+
+    void appendPath(HeaderBuffer& header, const fs::path& file_path);
+    void extractPath(std::istream& archive_in, std::uint16_t path_length, fs::path& out_path);
 
-    void writePath(const fs::path& file_path);
-    void extractPath(std::istream& archive_in, fs::path& out_path);
+    // write the completed header of a regular file entry followed by the file data, which is
+    // read from the input tree unless its `content` was read already
+    void writeFileData(HeaderBuffer& header, const fs::path& file_path,
+                       StreamHasher::hash_value_t checksum,
+                       const std::vector<char>* content = nullptr);
+    // data length and checksum of file data, the checksum is 0 in archives without checksums
+    std::pair<std::uint32_t, StreamHasher::hash_value_t> decodeFileData(const char* payload) const;
+    std::pair<std::uint32_t, StreamHasher::hash_value_t>
+    extractFileDataHeader(std::istream& archive_in);
 
-    void writeFileData(const fs::path& file_path);
-    void extractFileData(std::istream& archive_in, const fs::path& out_path);
+    // compute the blob key of a file and make sure the blob store holds its data; returns false
+    // if the store holds different data under the same key, the data is then kept in the archive
+    bool storeFileData(const fs::path& file_path, BlobKey& key);
+    // write a reference to file data held by the blob store
+    void writeBlobRef(HeaderBuffer& header, const BlobKey& key);
+    static BlobKey decodeBlobKey(const char* payload);
+    // keys of all blobs referenced by the archive, which must be positioned after its header
+    BlobKeySet collectBlobReferences(std::istream& archive_in);
 
     const StreamHasher& hasher_;
-    fs::path input_root_;
+    IoTuning tuning_;
+    // chunk buffers of all I/O loops, reused across files
+    BufferPool buffers_;
+    // tree and archive stream of the pack call in progress
+    InputTree* input_ = nullptr;
+    std::ostream* archive_out_ = nullptr;
     int current_depth_ = 0;
-    std::ofstream archive_file_;
+    // store of the pack call in progress and the blobs referenced so far
+    BlobStore* store_ = nullptr;
+    BlobKeySet referenced_blobs_;
+    // files of the pack call in progress which are candidate delta bases, when enabled
+    bool delta_encoding_ = false;
+    SimilarityIndex similarity_index_;
+    // bytes of files considered for delta encoding and of encodeDelta work spent on them
+    std::uint64_t delta_input_bytes_ = 0;
+    std::uint64_t delta_work_bytes_ = 0;
+    // format flags and blob store id of the archive being read
+    std::uint16_t archive_flags_ = 0;
+    ArchiveId archive_id_{};
+    // format flags of the archive being written
+    std::uint16_t output_flags_ = 0;
+    // entry names seen so far in archives with a name table, being written and being read
+    NameTable output_names_;
+    NameTable input_names_;
+    // entry name and fixed fields of the entry header read last
+    std::vector<char> entry_buffer_;
 
     // store the mapping of file hashes to their original paths and offsets for duplicate detection
     typedef std::pair<fs::path, std::streamoff> PathOffsetPair;
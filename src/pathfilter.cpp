@@ -0,0 +1,49 @@
+#include "pathfilter.h"
+
+#include <fnmatch.h>
+#include <utility>
+
+namespace packer {
+
+PathFilter::PathFilter(std::vector<std::string> include_patterns,
+                       std::vector<std::string> exclude_patterns)
+    : include_patterns_(std::move(include_patterns)),
+      exclude_patterns_(std::move(exclude_patterns)) {}
+
+PathFilter::Selection PathFilter::root() const {
+    Selection selection;
+    selection.included = include_patterns_.empty();
+    return selection;
+}
+
+PathFilter::Selection PathFilter::select(const Selection& parent,
+                                         const fs::path& relative_path) const {
+    if (selectsAll()) {
+        return parent;
+    }
+    const std::string path_str = relative_path.generic_string();
+    const std::string name = relative_path.filename().string();
+
+    Selection selection = parent;
+    if (!selection.included) {
+        selection.included = matchesAny(include_patterns_, path_str, name);
+    }
+    if (!selection.excluded) {
+        selection.excluded = matchesAny(exclude_patterns_, path_str, name);
+    }
+    return selection;
+}
+
+bool PathFilter::matchesAny(const std::vector<std::string>& patterns,
+                            const std::string& relative_path, const std::string& name) {
+    for (const std::string& pattern : patterns) {
+        const std::string& subject =
+            pattern.find('/') != std::string::npos ? relative_path : name;
+        if (::fnmatch(pattern.c_str(), subject.c_str(), FNM_PATHNAME) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace packer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// Glob based selection of archive entries by their path relative to the archive root.
+//
+// A pattern containing a '/' is matched against the whole relative path, any other pattern is
+// matched against the entry name alone, at any depth. '*' and '?' never match a '/'.
+// An entry is selected when it or one of its parent directories matches an include pattern
+// (or no include patterns are given) and neither it nor a parent matches an exclude pattern.
+class PathFilter {
+  public:
+    // selection state of an entry, the state of its parent directory is inherited
+    struct Selection {
+        bool included = true;
+        bool excluded = false;
+
+        bool selected() const { return included && !excluded; }
+    };
+
+    PathFilter(std::vector<std::string> include_patterns,
+               std::vector<std::string> exclude_patterns);
+
+    // true when every entry is selected
+    bool selectsAll() const { return include_patterns_.empty() && exclude_patterns_.empty(); }
+
+    // selection state of the archive root directory
+    Selection root() const;
+
+    // selection state of an entry inside a directory whose selection state is `parent`
+    Selection select(const Selection& parent, const fs::path& relative_path) const;
+
+  private:
+    static bool matchesAny(const std::vector<std::string>& patterns,
+                           const std::string& relative_path, const std::string& name);
+
+    std::vector<std::string> include_patterns_;
+    std::vector<std::string> exclude_patterns_;
+};
+
+} // namespace packer
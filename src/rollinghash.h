@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace packer {
+
+// finalizer of splitmix64, turns rolling hash values into well distributed keys
+inline std::uint64_t mixHash(std::uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value;
+}
+
+// Polynomial hash over a fixed-size window of bytes that can be moved by one byte in constant
+// time. Arithmetic is modulo 2^64, so values are only suitable as hash table keys after mixing
+// with mixHash.
+class RollingHash {
+  public:
+    explicit RollingHash(std::size_t window) : window_(window) {
+        for (std::size_t i = 1; i < window_; ++i) {
+            out_factor_ *= MULTIPLIER;
+        }
+    }
+
+    // hash of `window` bytes, equal to value() after reset(data)
+    std::uint64_t hash(const char* data) const {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < window_; ++i) {
+            value = value * MULTIPLIER + static_cast<unsigned char>(data[i]);
+        }
+        return value;
+    }
+
+    void reset(const char* data) { value_ = hash(data); }
+
+    // move the window by one byte, dropping `out` and appending `in`
+    void roll(char out, char in) {
+        value_ = (value_ - static_cast<unsigned char>(out) * out_factor_) * MULTIPLIER +
+                 static_cast<unsigned char>(in);
+    }
+
+    std::uint64_t value() const { return value_; }
+    std::size_t window() const { return window_; }
+
+  private:
+    static constexpr std::uint64_t MULTIPLIER = 0x100000001B3ull;
+
+    std::size_t window_;
+    // MULTIPLIER^(window - 1), the weight of the byte leaving the window
+    std::uint64_t out_factor_ = 1;
+    std::uint64_t value_ = 0;
+};
+
+} // namespace packer
@@ -0,0 +1,108 @@
+#include "similarityindex.h"
+
+#include "rollinghash.h"
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace packer {
+
+namespace {
+
+// seeds deriving the hash functions of the sketch components from a single window hash
+constexpr std::array<std::uint64_t, SimilarityIndex::SKETCH_SIZE> SKETCH_SEEDS = {
+    0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull,
+    0xFF51AFD7ED558CCDull, 0xC4CEB9FE1A85EC53ull, 0x2545F4914F6CDD1Dull, 0x632BE59BD9B4E019ull,
+};
+
+// odd multiplier spreading window hashes over the top bits that select sampled windows
+constexpr std::uint64_t SAMPLE_MULTIPLIER = 0xD1B54A32D192ED03ull;
+
+} // namespace
+
+SimilarityIndex::Sketch SimilarityIndex::computeSketch(const char* data, std::size_t size) {
+    Sketch sketch;
+    sketch.fill(std::numeric_limits<std::uint64_t>::max());
+    if (size < WINDOW_SIZE) {
+        return sketch;
+    }
+
+    RollingHash rolling(WINDOW_SIZE);
+    rolling.reset(data);
+    for (std::size_t pos = 0;; ++pos) {
+        const std::uint64_t window_hash = rolling.value();
+        // the top bits of a multiplicative hash select the sampled windows
+        if ((window_hash * SAMPLE_MULTIPLIER) >> (64 - SAMPLE_BITS) == 0) {
+            for (std::size_t i = 0; i < SKETCH_SIZE; ++i) {
+                sketch[i] = std::min(sketch[i], mixHash(window_hash ^ SKETCH_SEEDS[i]));
+            }
+        }
+        if (pos + WINDOW_SIZE == size) {
+            break;
+        }
+        rolling.roll(data[pos], data[pos + WINDOW_SIZE]);
+    }
+    return sketch;
+}
+
+bool SimilarityIndex::isEmpty(const Sketch& sketch) {
+    // all components are set by the same sampled windows
+    return sketch[0] == std::numeric_limits<std::uint64_t>::max();
+}
+
+void SimilarityIndex::add(const Sketch& sketch, Entry entry) {
+    if (isEmpty(sketch)) {
+        return;
+    }
+    const std::uint32_t index = static_cast<std::uint32_t>(entries_.size());
+    entries_.push_back(std::move(entry));
+    for (std::size_t i = 0; i < SKETCH_SIZE; ++i) {
+        buckets_[bucketKey(i, sketch[i])].push_back(index);
+    }
+}
+
+std::vector<SimilarityIndex::Entry> SimilarityIndex::find(const Sketch& sketch,
+                                                          std::size_t max_results,
+                                                          std::size_t min_shared) const {
+    if (isEmpty(sketch)) {
+        return {};
+    }
+    std::unordered_map<std::uint32_t, std::size_t> shared_components;
+    for (std::size_t i = 0; i < SKETCH_SIZE; ++i) {
+        const auto it = buckets_.find(bucketKey(i, sketch[i]));
+        if (it == buckets_.end()) {
+            continue;
+        }
+        for (std::uint32_t index : it->second) {
+            ++shared_components[index];
+        }
+    }
+
+    std::vector<std::pair<std::size_t, std::uint32_t>> ranked;
+    for (const auto& [index, shared] : shared_components) {
+        if (shared >= min_shared) {
+            ranked.emplace_back(shared, index);
+        }
+    }
+    // most shared components first, earlier entries first among equally similar ones
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    std::vector<Entry> results;
+    for (std::size_t i = 0; i < ranked.size() && i < max_results; ++i) {
+        results.push_back(entries_[ranked[i].second]);
+    }
+    return results;
+}
+
+void SimilarityIndex::clear() {
+    entries_.clear();
+    buckets_.clear();
+}
+
+std::uint64_t SimilarityIndex::bucketKey(std::size_t component, std::uint64_t value) {
+    return mixHash(value + component);
+}
+
+} // namespace packer
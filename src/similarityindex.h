@@ -0,0 +1,65 @@
+#pragma once
+
+#include "streamhasher.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ios>
+#include <unordered_map>
+#include <vector>
+
+namespace packer {
+
+namespace fs = std::filesystem;
+
+// Index of files already stored in an archive, queried for files with similar content.
+//
+// Every file is summarized by a MinHash sketch: for each of SKETCH_SIZE hash functions the
+// minimum hash over the windows of WINDOW_SIZE bytes of the content. The fraction of sketch
+// components two files share estimates how many of their windows they have in common, so a
+// lookup only has to count shared components instead of comparing any content.
+//
+// Only about one window in 2^SAMPLE_BITS is hashed into the sketch. Windows are picked by their
+// content, so equal content samples the same windows in every file and the estimate holds,
+// while the bulk of the bytes cost a rolling hash step and a multiplication only.
+class SimilarityIndex {
+  public:
+    static constexpr std::size_t SKETCH_SIZE = 8;
+    using Sketch = std::array<std::uint64_t, SKETCH_SIZE>;
+    // default number of components an entry has to share with a sketch to be found
+    static constexpr std::size_t MIN_SHARED_COMPONENTS = 2;
+
+    // a file stored in full which later files may be encoded against
+    struct Entry {
+        fs::path path;
+        // offset of the data length field of its file data in the archive
+        std::streamoff data_offset = 0;
+        std::uint64_t size = 0;
+        StreamHasher::hash_value_t hash = 0;
+    };
+
+    // sketch of the content; empty if no window of it was sampled
+    static Sketch computeSketch(const char* data, std::size_t size);
+    static bool isEmpty(const Sketch& sketch);
+
+    // entries with an empty sketch are never found, so they are not kept
+    void add(const Sketch& sketch, Entry entry);
+    // entries sharing at least `min_shared` sketch components, most similar first
+    std::vector<Entry> find(const Sketch& sketch, std::size_t max_results,
+                            std::size_t min_shared = MIN_SHARED_COMPONENTS) const;
+    void clear();
+
+  private:
+    static constexpr std::size_t WINDOW_SIZE = 16;
+    static constexpr unsigned SAMPLE_BITS = 4;
+
+    // bucket key of a sketch component, distinct for equal values at different positions
+    static std::uint64_t bucketKey(std::size_t component, std::uint64_t value);
+
+    std::vector<Entry> entries_;
+    // indices into entries_ per sketch component value
+    std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> buckets_;
+};
+
+} // namespace packer
@@ -2,8 +2,10 @@
 
 #include "xxhash.h"
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <istream>
+#include <memory>
 
 namespace packer {
 
@@ -15,6 +17,20 @@ class StreamHasher {
     virtual ~StreamHasher() = default;
     // Compute hash of stream content in one call
     virtual hash_value_t compute_hash(std::istream& input) const = 0;
+    // Compute hash of a contiguous memory buffer
+    virtual hash_value_t compute_hash(const char* data, std::size_t size) const = 0;
+
+    // Hash of data fed in consecutive pieces, for callers reading the data into their own
+    // (e.g. pooled) buffers
+    class State {
+      public:
+        virtual ~State() = default;
+        virtual void update(const char* data, std::size_t size) = 0;
+        // hash of all data fed so far, equal to compute_hash over the pieces concatenated
+        virtual hash_value_t digest() const = 0;
+    };
+    // Start hashing data fed piece by piece
+    virtual std::unique_ptr<State> start() const = 0;
 };
 
 } // namespace packer
@@ -3,6 +3,8 @@
 #define XXH_STATIC_LINKING_ONLY
 #include <xxhash.h>
 
+#include <stdexcept>
+
 namespace packer {
 
 class XXH3StateGuard {
@@ -25,13 +27,31 @@ class XXH3StateGuard {
     XXH3_state_t* state;
 };
 
+namespace {
+
+// incremental XXH3_64bits over the pieces fed by the caller
+class XXHasherState : public StreamHasher::State {
+  public:
+    XXHasherState() { XXH3_64bits_reset(state_.get()); }
+
+    void update(const char* data, std::size_t size) override {
+        XXH3_64bits_update(state_.get(), data, size);
+    }
+    StreamHasher::hash_value_t digest() const override { return XXH3_64bits_digest(state_.get()); }
+
+  private:
+    XXH3StateGuard state_;
+};
+
+} // namespace
+
 StreamHasher::hash_value_t XXHasher::compute_hash(std::istream& input) const {
     XXH3StateGuard stateGuard;
     XXH3_state_t* state = stateGuard.get();
     if (state) {
         XXH3_64bits_reset(state);
     }
-    constexpr std::size_t BUFFER_SIZE = 8192; // TODO: profile and tune buffer size
+    constexpr std::size_t BUFFER_SIZE = 8192;
     char buffer[BUFFER_SIZE];
     while (input.read(buffer, sizeof(buffer))) {
         XXH3_64bits_update(state, buffer, input.gcount());
@@ -44,4 +64,12 @@ StreamHasher::hash_value_t XXHasher::compute_hash(std::istream& input) const {
     return result;
 }
 
+StreamHasher::hash_value_t XXHasher::compute_hash(const char* data, std::size_t size) const {
+    return XXH3_64bits(data, size);
+}
+
+std::unique_ptr<StreamHasher::State> XXHasher::start() const {
+    return std::make_unique<XXHasherState>();
+}
+
 } // namespace packer
\ No newline at end of file
@@ -9,7 +9,11 @@ class XXHasher : public StreamHasher {
     XXHasher() = default;
     ~XXHasher() override = default;
 
+    // Packer reads streams into its pooled buffers of IoTuning::hash_chunk_size bytes and feeds
+    // start() instead of calling this
     hash_value_t compute_hash(std::istream& input) const override;
+    hash_value_t compute_hash(const char* data, std::size_t size) const override;
+    std::unique_ptr<State> start() const override;
 };
 
 } // namespace packer
\ No newline at end of file
@@ -1,6 +1,7 @@
 import filecmp
 import logging
 import os
+import shutil
 import subprocess
 from pathlib import Path
 from typing import Optional
@@ -14,8 +15,15 @@ def packer_path(request) -> Optional[Path]:
     return Path(val) if val else None
 
 
-def run_packer(packer_bin: Path, mode: str, src: Path, dst: Path, cwd: Path):
-    cmd = [str(packer_bin), mode, str(src), str(dst)]
+def run_packer(
+    packer_bin: Path,
+    mode: str,
+    src: Path,
+    dst: Path,
+    cwd: Path,
+    options: Optional[list[str]] = None,
+):
+    cmd = [str(packer_bin), mode, *(options or []), str(src), str(dst)]
 
     exc: subprocess.CalledProcessError | None = None
     try:
@@ -134,3 +142,374 @@ def test_pack_and_unpack_roundtrip(packer_path: Path, tmp_path: Path):
 
     # Compare unpacked tree to original input_dir
     assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_pack_locality_order_and_unpack_roundtrip(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root, options=["--locality"])
+    assert packed_file.exists(), "Packer did not produce output archive"
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir(parents=True, exist_ok=True)
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_verify_accepts_intact_archive(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    result = subprocess.run([str(packer_path), "verify", str(packed_file)], cwd=repo_root)
+    assert result.returncode == 0, "verify rejected an intact archive"
+
+
+def test_verify_detects_corrupted_file_data(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    # flip one byte of the content shared by file_one.txt and its duplicates
+    content = (input_dir / "file_one.txt").read_bytes()
+    data = bytearray(packed_file.read_bytes())
+    pos = data.find(content)
+    assert pos >= 0, "file content not found in archive"
+    data[pos] ^= 0xFF
+    packed_file.write_bytes(bytes(data))
+
+    result = subprocess.run(
+        [str(packer_path), "verify", str(packed_file)],
+        cwd=repo_root,
+        capture_output=True,
+        text=True,
+    )
+    assert result.returncode != 0, "verify accepted a corrupted archive"
+    assert "Checksum mismatch" in result.stderr
+
+
+def test_verify_detects_truncated_archive(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+    data = packed_file.read_bytes()
+    packed_file.write_bytes(data[:-1])
+
+    result = subprocess.run(
+        [str(packer_path), "verify", str(packed_file)],
+        cwd=repo_root,
+        capture_output=True,
+        text=True,
+    )
+    assert result.returncode != 0, "verify accepted a truncated archive"
+    assert "structure error" in result.stderr
+
+
+def test_unpack_include_restores_only_selected_subtree(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir(parents=True, exist_ok=True)
+    run_packer(
+        packer_path,
+        "unpack",
+        packed_file,
+        unpack_dir,
+        cwd=repo_root,
+        options=["--include", "subdir"],
+    )
+
+    # subdir/file_one.copy has the same content as files outside the selection,
+    # so it is restored from file data that is not extracted itself
+    assert sorted(p.name for p in unpack_dir.iterdir()) == ["subdir"]
+    assert_dirs_equal(input_dir / "subdir", unpack_dir / "subdir")
+
+
+def test_unpack_exclude_skips_matching_entries(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir(parents=True, exist_ok=True)
+    run_packer(
+        packer_path,
+        "unpack",
+        packed_file,
+        unpack_dir,
+        cwd=repo_root,
+        options=["--exclude", "*.txt", "--exclude", "*.symlink"],
+    )
+
+    unpacked = sorted(str(p.relative_to(unpack_dir)) for p in unpack_dir.rglob("*"))
+    assert unpacked == [
+        "empty.dat",
+        "file1.bak",
+        "subdir",
+        "subdir/data.dat",
+        "subdir/file_one.copy",
+    ]
+    assert (unpack_dir / "subdir" / "file_one.copy").read_bytes() == (
+        input_dir / "subdir" / "file_one.copy"
+    ).read_bytes()
+
+
+@pytest.mark.parametrize("sync_mode", ["end", "batch"])
+def test_unpack_with_sync_mode_roundtrip(packer_path: Path, tmp_path: Path, sync_mode: str):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir(parents=True, exist_ok=True)
+    run_packer(
+        packer_path,
+        "unpack",
+        packed_file,
+        unpack_dir,
+        cwd=repo_root,
+        options=[f"--sync={sync_mode}"],
+    )
+
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_pack_against_blob_store_export_and_gc(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+    store_dir = tmp_path / "store"
+    store_option = ["--store", str(store_dir)]
+
+    first = tmp_path / "first.pak"
+    second = tmp_path / "second.pak"
+    run_packer(packer_path, "pack", input_dir, first, cwd=repo_root, options=store_option)
+    segments_size = sum(f.stat().st_size for f in (store_dir / "segments").iterdir())
+    run_packer(packer_path, "pack", input_dir, second, cwd=repo_root, options=store_option)
+    # the second archive only adds references, no data
+    assert sum(f.stat().st_size for f in (store_dir / "segments").iterdir()) == segments_size
+    content = (input_dir / "file_one.txt").read_bytes()
+    assert content not in second.read_bytes()
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", second, unpack_dir, cwd=repo_root, options=store_option)
+    assert_dirs_equal(input_dir, unpack_dir)
+
+    exported = tmp_path / "exported.pak"
+    run_packer(packer_path, "export", first, exported, cwd=repo_root, options=store_option)
+    subprocess.run(
+        [str(packer_path), "release", *store_option, str(first)], cwd=repo_root, check=True
+    )
+    subprocess.run(
+        [str(packer_path), "release", *store_option, str(second)], cwd=repo_root, check=True
+    )
+    subprocess.run([str(packer_path), "gc", str(store_dir)], cwd=repo_root, check=True)
+    assert not any((store_dir / "segments").iterdir())
+
+    # the exported archive does not need the store
+    exported_dir = tmp_path / "exported"
+    exported_dir.mkdir()
+    run_packer(packer_path, "unpack", exported, exported_dir, cwd=repo_root)
+    assert_dirs_equal(input_dir, exported_dir)
+
+
+def test_pack_with_delta_encoding_roundtrip(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = tmp_path / "input"
+    (input_dir / "hosts").mkdir(parents=True)
+    config = b"".join(b"option_%d = %d\n" % (i, i * 31) for i in range(4000))
+    (input_dir / "base.conf").write_bytes(config)
+    for host in range(5):
+        variant = config.replace(b"option_%d =" % (host * 500), b"patched_%d =" % host)
+        (input_dir / "hosts" / f"host{host}.conf").write_bytes(variant)
+
+    plain = tmp_path / "plain.pak"
+    run_packer(packer_path, "pack", input_dir, plain, cwd=repo_root)
+    packed_file = tmp_path / "delta.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root, options=["--delta"])
+    assert packed_file.stat().st_size * 3 < plain.stat().st_size
+
+    result = subprocess.run([str(packer_path), "verify", str(packed_file)], cwd=repo_root)
+    assert result.returncode == 0, "verify rejected a delta encoded archive"
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_pack_files_from_list_roundtrip(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = tmp_path / "input"
+    (input_dir / "changed" / "deep").mkdir(parents=True)
+    (input_dir / "untouched").mkdir()
+    (input_dir / "changed" / "deep" / "a.txt").write_bytes(b"same data")
+    (input_dir / "changed" / "b.txt").write_bytes(b"same data")
+    (input_dir / "untouched" / "c.txt").write_bytes(b"not listed")
+    (input_dir / "top.txt").write_bytes(b"top")
+
+    packed_file = tmp_path / "list.pak"
+    cmd = [str(packer_path), "pack", "--files-from", "-", str(input_dir), str(packed_file)]
+    subprocess.run(
+        cmd, cwd=repo_root, check=True, input=b"top.txt\0changed/deep/a.txt\0changed/b.txt\0"
+    )
+    assert packed_file.read_bytes().count(b"same data") == 1
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+    (input_dir / "untouched" / "c.txt").unlink()
+    (input_dir / "untouched").rmdir()
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_calibrate_saves_tuning_used_by_pack_and_unpack(
+    packer_path: Path, tmp_path: Path, monkeypatch: pytest.MonkeyPatch
+):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+    tuning_file = tmp_path / "config" / "io_tuning"
+    monkeypatch.setenv("PACKER_TUNING_FILE", str(tuning_file))
+    scratch_dir = tmp_path / "scratch"
+    scratch_dir.mkdir()
+
+    subprocess.run(
+        [str(packer_path), "calibrate", "--sample-size", "1", str(scratch_dir)],
+        cwd=repo_root,
+        check=True,
+    )
+    settings = dict(
+        line.split("=") for line in tuning_file.read_text().splitlines() if "=" in line
+    )
+    assert set(settings) == {"read_chunk_size", "hash_chunk_size", "write_chunk_size"}
+    assert not any(scratch_dir.iterdir())
+
+    # smallest chunks allowed, every file takes several chunks
+    tuning_file.write_text("read_chunk_size=4096\nhash_chunk_size=4096\nwrite_chunk_size=4096\n")
+    packed_file = tmp_path / "tuned.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+    assert_dirs_equal(input_dir, unpack_dir)
+
+    tuning_file.write_text("read_chunk_size=1\n")
+    result = subprocess.run(
+        [str(packer_path), "verify", str(packed_file)], cwd=repo_root, capture_output=True
+    )
+    assert result.returncode != 0
+
+
+def test_pack_with_name_table_roundtrip(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = tmp_path / "input"
+    for i in range(200):
+        module = input_dir / "node_modules" / f"module_{i}"
+        (module / "lib").mkdir(parents=True)
+        (module / "index.js").write_text(f"module.exports = {i};\n")
+        (module / "package.json").write_text(f'{{"name": "module_{i}"}}\n')
+        (module / "LICENSE").write_text("MIT\n")
+        os.symlink("../index.js", module / "lib" / "main.js")
+
+    plain = tmp_path / "plain.pak"
+    run_packer(packer_path, "pack", input_dir, plain, cwd=repo_root)
+    packed_file = tmp_path / "names.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root, options=["--name-table"])
+    assert packed_file.read_bytes().count(b"package.json") == 1
+    assert packed_file.stat().st_size < plain.stat().st_size
+
+    result = subprocess.run([str(packer_path), "verify", str(packed_file)], cwd=repo_root)
+    assert result.returncode == 0, "verify rejected an archive with a name table"
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_unpack_update_rewrites_only_changed_files(packer_path: Path, tmp_path: Path):
+    repo_root = Path(__file__).resolve().parents[2]
+    input_dir = repo_root / "tests" / "data"
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=repo_root)
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root)
+    files = sorted(p for p in unpack_dir.rglob("*") if p.is_file() and not p.is_symlink())
+    assert len(files) >= 2
+    changed, unchanged = files[0], files[1]
+    changed.write_bytes(b"locally modified")
+    unchanged_inode = unchanged.stat().st_ino
+    (unpack_dir / "stale.txt").write_bytes(b"not in the archive")
+
+    run_packer(
+        packer_path, "unpack", packed_file, unpack_dir, cwd=repo_root, options=["--update"]
+    )
+    assert unchanged.stat().st_ino == unchanged_inode
+    assert (unpack_dir / "stale.txt").exists()
+    (unpack_dir / "stale.txt").unlink()
+    assert_dirs_equal(input_dir, unpack_dir)
+
+    (unpack_dir / "stale.txt").write_bytes(b"not in the archive")
+    run_packer(
+        packer_path,
+        "unpack",
+        packed_file,
+        unpack_dir,
+        cwd=repo_root,
+        options=["--update", "--remove-stale"],
+    )
+    assert unchanged.stat().st_ino == unchanged_inode
+    assert_dirs_equal(input_dir, unpack_dir)
+
+
+def test_unpack_update_replaces_entries_that_changed_type(packer_path: Path, tmp_path: Path):
+    input_dir = tmp_path / "input"
+    (input_dir / "x").mkdir(parents=True)
+    (input_dir / "x" / "inner.txt").write_bytes(b"inside a directory")
+    (input_dir / "y").write_bytes(b"a regular file")
+    (input_dir / "z").mkdir()
+    packed_file = tmp_path / "archive.pak"
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=tmp_path)
+
+    unpack_dir = tmp_path / "unpacked"
+    unpack_dir.mkdir()
+    run_packer(packer_path, "unpack", packed_file, unpack_dir, cwd=tmp_path)
+
+    # every entry changes its type for the next release
+    shutil.rmtree(input_dir / "x")
+    (input_dir / "x").write_bytes(b"now a regular file")
+    (input_dir / "y").unlink()
+    (input_dir / "y").mkdir()
+    (input_dir / "y" / "inner.txt").write_bytes(b"now inside a directory")
+    (input_dir / "z").rmdir()
+    (input_dir / "z").symlink_to("x")
+    run_packer(packer_path, "pack", input_dir, packed_file, cwd=tmp_path)
+
+    run_packer(
+        packer_path,
+        "unpack",
+        packed_file,
+        unpack_dir,
+        cwd=tmp_path,
+        options=["--update", "--remove-stale"],
+    )
+    assert_dirs_equal(input_dir, unpack_dir)
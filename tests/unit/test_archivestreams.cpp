@@ -0,0 +1,119 @@
+#include "archivestreams.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+static std::string to_string(const std::vector<char>& v) {
+    return std::string(v.begin(), v.end());
+}
+
+TEST(MemorySinkBufTest, AppendsAndTruncatesOnSeekBack) {
+    std::vector<char> buffer;
+    MemorySinkBuf buf(buffer);
+    std::ostream out(&buf);
+
+    out << "hello";
+    EXPECT_EQ(out.tellp(), 5);
+    out << " world";
+    out.seekp(5);
+    out << "!";
+
+    EXPECT_EQ(to_string(buffer), "hello!");
+}
+
+TEST(CallbackSinkBufTest, DeliversDataInOrderOnFlush) {
+    std::string delivered;
+    CallbackSinkBuf buf([&](const char* data, std::size_t size) { delivered.append(data, size); },
+                        8);
+    std::ostream out(&buf);
+
+    out << "abc";
+    EXPECT_EQ(delivered, "");
+    out << "defghijklmnop"; // larger than the buffer
+    out.flush();
+
+    EXPECT_EQ(delivered, "abcdefghijklmnop");
+    EXPECT_EQ(out.tellp(), 16);
+}
+
+TEST(CallbackSinkBufTest, RollsBackPendingDataOnly) {
+    std::string delivered;
+    CallbackSinkBuf buf([&](const char* data, std::size_t size) { delivered.append(data, size); });
+    std::ostream out(&buf);
+
+    out << "keep";
+    out.flush();
+    out << "drop";
+    out.seekp(4);
+    out << "!";
+    out.flush();
+    EXPECT_EQ(delivered, "keep!");
+
+    out.seekp(2); // already delivered
+    EXPECT_TRUE(out.fail());
+}
+
+TEST(SpanSourceBufTest, ReadsAndSeeks) {
+    const std::string data = "0123456789";
+    SpanIStream in(data.data(), data.size());
+
+    char c = 0;
+    in.seekg(7);
+    in.get(c);
+    EXPECT_EQ(c, '7');
+    in.seekg(-5, std::ios::end);
+    in.get(c);
+    EXPECT_EQ(c, '5');
+    in.seekg(0, std::ios::end);
+    EXPECT_EQ(in.tellg(), 10);
+    EXPECT_EQ(in.get(), std::char_traits<char>::eof());
+}
+
+TEST(CallbackSourceBufTest, ReadsAcrossBufferRefillsAndSeeks) {
+    std::string data;
+    for (int i = 0; i < 1000; ++i) {
+        data.push_back(static_cast<char>('a' + i % 26));
+    }
+    std::size_t calls = 0;
+    CallbackSourceBuf buf(
+        [&](std::uint64_t offset, char* out, std::size_t size) {
+            ++calls;
+            if (offset >= data.size()) {
+                return std::size_t{0};
+            }
+            const std::size_t n = std::min(size, data.size() - offset);
+            std::memcpy(out, data.data() + offset, n);
+            return n;
+        },
+        16);
+    std::istream in(&buf);
+
+    std::string small(10, '\0');
+    in.read(small.data(), small.size());
+    EXPECT_EQ(small, data.substr(0, 10));
+
+    std::string large(500, '\0'); // larger than the buffer, read directly
+    in.read(large.data(), large.size());
+    EXPECT_EQ(large, data.substr(10, 500));
+    EXPECT_EQ(in.tellg(), 510);
+
+    in.seekg(3);
+    char c = 0;
+    in.get(c);
+    EXPECT_EQ(c, data[3]);
+
+    in.seekg(995);
+    std::string tail(10, '\0');
+    in.read(tail.data(), tail.size());
+    EXPECT_EQ(in.gcount(), 5);
+    EXPECT_TRUE(in.eof());
+    EXPECT_GT(calls, 0u);
+}
@@ -0,0 +1,119 @@
+#include "blobstore.h"
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <sstream>
+#include <string>
+
+using namespace packer;
+
+namespace {
+
+class BlobStoreTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        root_ = fs::temp_directory_path() /
+                ("packer_blobstore_" +
+                 std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(root_);
+    }
+    void TearDown() override { fs::remove_all(root_); }
+
+    static BlobKey computeKey(std::istream& data, std::uint64_t size) {
+        // a buffer smaller than the data exercises the chunk loop
+        char buffer[2];
+        return BlobStore::computeKey(data, size, buffer, sizeof(buffer));
+    }
+
+    static BlobKey put(BlobStore& store, const std::string& data) {
+        std::istringstream key_in(data);
+        const BlobKey key = computeKey(key_in, data.size());
+        std::istringstream data_in(data);
+        store.put(key, data_in);
+        return key;
+    }
+
+    static std::string read(BlobStore& store, const BlobKey& key) {
+        std::unique_ptr<std::istream> blob_in = store.open(key);
+        std::string data(key.size, '\0');
+        blob_in->read(data.data(), static_cast<std::streamsize>(data.size()));
+        return data;
+    }
+
+    fs::path root_;
+};
+
+} // namespace
+
+TEST_F(BlobStoreTest, KeyDependsOnContentAndSize) {
+    std::istringstream a("abc"), b("abd"), c("abc");
+    const BlobKey key_a = computeKey(a, 3);
+    EXPECT_FALSE(key_a == computeKey(b, 3));
+    EXPECT_FALSE(key_a == computeKey(c, 2));
+
+    std::istringstream short_in("ab");
+    EXPECT_THROW(computeKey(short_in, 3), std::runtime_error);
+}
+
+TEST_F(BlobStoreTest, StoresBlobsOnceAndPersistsIndex) {
+    BlobKey first;
+    BlobKey second;
+    {
+        BlobStore store(root_);
+        first = put(store, "shared library");
+        second = put(store, "config");
+        put(store, "shared library");
+        EXPECT_EQ(store.blobCount(), 2u);
+        EXPECT_EQ(read(store, first), "shared library");
+        store.save();
+    }
+
+    BlobStore store(root_);
+    EXPECT_EQ(store.blobCount(), 2u);
+    EXPECT_TRUE(store.contains(first));
+    EXPECT_EQ(read(store, second), "config");
+}
+
+TEST_F(BlobStoreTest, ReadOnlyStoresShareTheLock) {
+    EXPECT_THROW(BlobStore(root_, store_access::read_only), std::runtime_error);
+    BlobKey key;
+    {
+        BlobStore store(root_);
+        key = put(store, "shared library");
+        store.save();
+    }
+
+    // a second reader would block here if readers locked the store exclusively
+    BlobStore reader(root_, store_access::read_only);
+    BlobStore other_reader(root_, store_access::read_only);
+    EXPECT_EQ(read(reader, key), "shared library");
+    EXPECT_EQ(read(other_reader, key), "shared library");
+    EXPECT_THROW(put(reader, "config"), std::runtime_error);
+    EXPECT_THROW(reader.save(), std::runtime_error);
+    EXPECT_THROW(reader.collectGarbage(), std::runtime_error);
+}
+
+TEST_F(BlobStoreTest, GarbageCollectionKeepsReferencedBlobs) {
+    BlobStore store(root_);
+    const BlobKey shared = put(store, "shared");
+    const BlobKey only_first = put(store, std::string(1000, 'f'));
+    const BlobKey only_second = put(store, "second");
+    const ArchiveId first_archive{1};
+    const ArchiveId second_archive{2};
+    store.registerArchive(first_archive, {shared, only_first});
+    store.registerArchive(second_archive, {shared, only_second});
+
+    EXPECT_EQ(store.collectGarbage(), 0u);
+    EXPECT_TRUE(store.releaseArchive(first_archive, {shared, only_first}));
+    EXPECT_FALSE(store.releaseArchive(first_archive, {shared, only_first}));
+
+    EXPECT_EQ(store.collectGarbage(), 1000u);
+    EXPECT_FALSE(store.contains(only_first));
+    EXPECT_EQ(read(store, shared), "shared");
+    EXPECT_EQ(read(store, only_second), "second");
+
+    // new blobs go to a fresh segment after compaction
+    const BlobKey added = put(store, "added later");
+    EXPECT_EQ(read(store, added), "added later");
+}
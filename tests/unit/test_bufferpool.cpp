@@ -0,0 +1,54 @@
+#include "bufferpool.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+using namespace packer;
+
+TEST(BufferPoolTest, ReusesReleasedBuffers) {
+    BufferPool pool;
+    const char* first_data = nullptr;
+    {
+        BufferPool::Buffer buffer = pool.acquire(64 * 1024);
+        first_data = buffer.data();
+        std::memset(buffer.data(), 'x', buffer.size());
+    }
+    for (int i = 0; i < 100; ++i) {
+        BufferPool::Buffer buffer = pool.acquire(16 * 1024);
+        EXPECT_EQ(buffer.data(), first_data);
+        EXPECT_EQ(buffer.size(), 16u * 1024);
+    }
+    EXPECT_EQ(pool.allocationCount(), 1u);
+
+    // buffers in use are never handed out twice
+    BufferPool::Buffer a = pool.acquire(1024);
+    BufferPool::Buffer b = pool.acquire(1024);
+    EXPECT_NE(a.data(), b.data());
+    EXPECT_EQ(pool.allocationCount(), 2u);
+}
+
+TEST(BufferPoolTest, AlignsBuffersToPages) {
+    BufferPool pool;
+    const BufferPool::Buffer small = pool.acquire(100);
+    const BufferPool::Buffer large = pool.acquire(3 * 1024 * 1024);
+
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(small.data()) % BufferPool::PAGE_SIZE, 0u);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large.data()) % BufferPool::HUGE_PAGE_SIZE, 0u);
+    std::memset(large.data(), 0, large.size());
+}
+
+TEST(BufferPoolTest, MovedBufferIsReturnedOnce) {
+    BufferPool pool;
+    {
+        BufferPool::Buffer buffer = pool.acquire(4096);
+        BufferPool::Buffer moved = std::move(buffer);
+        EXPECT_NE(moved.data(), nullptr);
+    }
+    const BufferPool::Buffer a = pool.acquire(4096);
+    const BufferPool::Buffer b = pool.acquire(4096);
+    EXPECT_NE(a.data(), b.data());
+    EXPECT_EQ(pool.allocationCount(), 2u);
+}
@@ -0,0 +1,86 @@
+#include "delta.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+std::string randomContent(std::size_t size, unsigned seed) {
+    std::mt19937 random(seed);
+    std::string content(size, '\0');
+    for (char& c : content) {
+        c = static_cast<char>(random());
+    }
+    return content;
+}
+
+std::string roundTrip(const std::string& base, const std::string& target,
+                      std::size_t max_delta_size, bool& encoded) {
+    std::vector<char> delta;
+    encoded = encodeDelta(base.data(), base.size(), target.data(), target.size(), max_delta_size,
+                          delta);
+    if (!encoded) {
+        return {};
+    }
+    const std::vector<char> rebuilt =
+        applyDelta(base.data(), base.size(), delta.data(), delta.size(), target.size());
+    return std::string(rebuilt.begin(), rebuilt.end());
+}
+
+} // namespace
+
+TEST(DeltaTest, SmallEditsGiveSmallDelta) {
+    const std::string base = randomContent(64 * 1024, 1);
+    std::string target = base;
+    target[100] ^= 0x55;
+    target.insert(30000, "inserted bytes");
+    target.erase(50000, 1000);
+    target += "appended tail";
+
+    std::vector<char> delta;
+    ASSERT_TRUE(encodeDelta(base.data(), base.size(), target.data(), target.size(), 1024, delta));
+    const std::vector<char> rebuilt =
+        applyDelta(base.data(), base.size(), delta.data(), delta.size(), target.size());
+    EXPECT_EQ(std::string(rebuilt.begin(), rebuilt.end()), target);
+}
+
+TEST(DeltaTest, GivesUpOnUnrelatedContent) {
+    const std::string base = randomContent(8192, 2);
+    const std::string target = randomContent(8192, 3);
+
+    bool encoded = true;
+    roundTrip(base, target, target.size() / 2, encoded);
+    EXPECT_FALSE(encoded);
+}
+
+TEST(DeltaTest, ReorderedBlocksAreCopied) {
+    const std::string first = randomContent(4096, 4);
+    const std::string second = randomContent(4096, 5);
+
+    bool encoded = false;
+    const std::string target = second + first;
+    EXPECT_EQ(roundTrip(first + second, target, 256, encoded), target);
+    EXPECT_TRUE(encoded);
+}
+
+TEST(DeltaTest, MalformedDeltaThrows) {
+    const std::string base = randomContent(1024, 6);
+    // copy beyond the end of the base
+    const std::vector<char> out_of_bounds = {0, 0, 4, 0, 0, 0, 4, 0, 0};
+    EXPECT_THROW(applyDelta(base.data(), base.size(), out_of_bounds.data(), out_of_bounds.size(),
+                            1024),
+                 std::runtime_error);
+    // insert announcing more bytes than present
+    const std::vector<char> truncated = {1, 10, 0, 0, 0, 'a'};
+    EXPECT_THROW(applyDelta(base.data(), base.size(), truncated.data(), truncated.size(), 10),
+                 std::runtime_error);
+    // valid copy of fewer bytes than the target size
+    const std::vector<char> short_copy = {0, 0, 0, 0, 0, 16, 0, 0, 0};
+    EXPECT_THROW(applyDelta(base.data(), base.size(), short_copy.data(), short_copy.size(), 32),
+                 std::runtime_error);
+}
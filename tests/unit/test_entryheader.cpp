@@ -0,0 +1,410 @@
+#include "entryheader.h"
+
+#include "archivestreams.h"
+#include "byteorder.h"
+#include "memorytree.h"
+#include "packer.h"
+#include "xxhasher.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+// fields of one entry header, encoded both ways below
+struct HeaderFields {
+    std::uint8_t type = 0;
+    std::string name;
+    // symlink target
+    std::string target;
+    std::uint64_t a = 0;
+    std::uint64_t b = 0;
+    std::uint64_t c = 0;
+    std::uint64_t d = 0;
+};
+
+// the original encoder: one stream call per field
+std::string encodeWithStreamCalls(const HeaderFields& fields) {
+    std::ostringstream out;
+    out.write(reinterpret_cast<const char*>(&fields.type), 1);
+    if (fields.type == 4) { // leave_directory
+        write_le16(out, static_cast<std::uint16_t>(fields.a));
+        return out.str();
+    }
+    write_le16(out, static_cast<std::uint16_t>(fields.name.size()));
+    out.write(fields.name.data(), static_cast<std::streamsize>(fields.name.size()));
+    switch (fields.type) {
+        case 1: // regular
+            write_le32(out, static_cast<std::uint32_t>(fields.a));
+            write_le64(out, fields.b);
+            break;
+        case 2: // duplicate
+            write_le64(out, fields.a);
+            break;
+        case 5: // symlink
+            write_le16(out, static_cast<std::uint16_t>(fields.target.size()));
+            out.write(fields.target.data(), static_cast<std::streamsize>(fields.target.size()));
+            break;
+        case 10: // blob_ref
+            write_le64(out, fields.a);
+            write_le64(out, fields.b);
+            write_le64(out, fields.c);
+            break;
+        case 11: // delta
+            write_le64(out, fields.a);
+            write_le32(out, static_cast<std::uint32_t>(fields.b));
+            write_le64(out, fields.c);
+            write_le32(out, static_cast<std::uint32_t>(fields.d));
+            break;
+        default: // directory
+            break;
+    }
+    return out.str();
+}
+
+std::string encodeWithLayouts(const HeaderFields& fields) {
+    HeaderBuffer header;
+    if (fields.type == 4) {
+        header.append<EntryPrefixLayout>(fields.type, static_cast<std::uint16_t>(fields.a));
+    } else {
+        header.append<EntryPrefixLayout>(fields.type,
+                                         static_cast<std::uint16_t>(fields.name.size()));
+        header.appendBytes(fields.name);
+    }
+    switch (fields.type) {
+        case 1:
+            header.append<FileDataLayout>(static_cast<std::uint32_t>(fields.a), fields.b);
+            break;
+        case 2:
+            header.append<DuplicateLayout>(fields.a);
+            break;
+        case 5:
+            header.append<SymlinkLayout>(static_cast<std::uint16_t>(fields.target.size()));
+            header.appendBytes(fields.target);
+            break;
+        case 10:
+            header.append<BlobRefLayout>(fields.a, fields.b, fields.c);
+            break;
+        case 11:
+            header.append<DeltaLayout>(fields.a, static_cast<std::uint32_t>(fields.b), fields.c,
+                                       static_cast<std::uint32_t>(fields.d));
+            break;
+        default:
+            break;
+    }
+    return std::string(header.data(), header.size());
+}
+
+// names and symlink targets around and beyond the inline buffer size exercise the heap fallback
+std::size_t randomNameSize(std::mt19937_64& random) {
+    return random() % 8 == 0 ? random() % (2 * HeaderBuffer::INLINE_SIZE) + 1
+                             : random() % 40 + 1;
+}
+
+HeaderFields randomFields(std::mt19937_64& random) {
+    static constexpr std::uint8_t TYPES[] = {1, 2, 3, 4, 5, 10, 11};
+    HeaderFields fields;
+    fields.type = TYPES[random() % std::size(TYPES)];
+    const std::size_t name_size = randomNameSize(random);
+    for (std::size_t i = 0; i < name_size; ++i) {
+        fields.name.push_back(static_cast<char>(random()));
+    }
+    if (fields.type == 5) {
+        const std::size_t target_size = randomNameSize(random);
+        for (std::size_t i = 0; i < target_size; ++i) {
+            fields.target.push_back(static_cast<char>(random()));
+        }
+    }
+    fields.a = random() >> (random() % 64);
+    fields.b = random() >> (random() % 64);
+    fields.c = random();
+    fields.d = random() >> (random() % 64);
+    if (fields.type == 4) {
+        fields.a &= 0xFFFF;
+    }
+    return fields;
+}
+
+// a name valid in any directory: no separators, NULs or dot entries
+std::string randomEntryName(std::mt19937_64& random) {
+    std::string name;
+    const std::size_t size = randomNameSize(random);
+    while (name.size() < size) {
+        const char c = static_cast<char>(random() % 255 + 1);
+        if (c != '/') {
+            name.push_back(c);
+        }
+    }
+    return name == "." || name == ".." ? name + "x" : name;
+}
+
+// Random tree exercising every entry type Packer writes without a blob store: names repeated
+// across directories, long names and symlink targets, directories at random depths (so leave
+// directory entries of varying depth), duplicate and slightly modified file contents.
+MemoryTree randomTree(std::mt19937_64& random) {
+    MemoryTree tree;
+    std::vector<fs::path> directories{fs::path()};
+    std::vector<std::string> contents;
+    std::vector<std::string> common_names;
+    for (int i = 0; i < 16; ++i) {
+        common_names.push_back(randomEntryName(random));
+    }
+    for (int i = 0; i < 300; ++i) {
+        const fs::path parent = directories[random() % directories.size()];
+        const fs::path path =
+            parent / (random() % 2 == 0 ? common_names[random() % common_names.size()]
+                                        : randomEntryName(random));
+        if (tree.find(path) != nullptr) {
+            continue;
+        }
+        switch (random() % 4) {
+            case 0:
+                tree.addDirectory(path);
+                directories.push_back(path);
+                break;
+            case 1:
+                tree.addSymlink(path, randomEntryName(random) + "/" + randomEntryName(random));
+                break;
+            default: {
+                std::string content;
+                const std::uint64_t kind = random() % 4;
+                if (kind == 0 && !contents.empty()) {
+                    content = contents[random() % contents.size()];
+                } else if (kind == 1 && !contents.empty()) {
+                    content = contents[random() % contents.size()];
+                    for (int j = 0; j < 3 && !content.empty(); ++j) {
+                        content[random() % content.size()] = static_cast<char>(random());
+                    }
+                } else {
+                    content.resize(random() % 3000);
+                    for (char& c : content) {
+                        c = static_cast<char>(random());
+                    }
+                }
+                contents.push_back(content);
+                tree.addFile(path, std::move(content));
+                break;
+            }
+        }
+    }
+    return tree;
+}
+
+void expectSameTree(const MemoryTree::Node& expected, const MemoryTree::Node& actual,
+                    const std::string& path = "") {
+    ASSERT_EQ(expected.type, actual.type) << path;
+    ASSERT_EQ(expected.data, actual.data) << path;
+    ASSERT_EQ(expected.children.size(), actual.children.size()) << path;
+    for (const auto& [name, child] : expected.children) {
+        const auto it = actual.children.find(name);
+        ASSERT_NE(it, actual.children.end()) << path + "/" + name;
+        expectSameTree(child, it->second, path + "/" + name);
+    }
+}
+
+} // namespace
+
+TEST(EntryHeaderTest, LayoutSizesAndOffsets) {
+    static_assert(EntryPrefixLayout::SIZE == 3);
+    static_assert(FileDataLayout::SIZE == 12);
+    static_assert(DeltaLayout::SIZE == 24);
+
+    char buffer[DeltaLayout::SIZE];
+    DeltaLayout::encode(buffer, 0x0102030405060708ull, 0x11223344u, 0xA1A2A3A4A5A6A7A8ull,
+                        0x55667788u);
+    EXPECT_EQ(static_cast<unsigned char>(buffer[0]), 0x08);
+    EXPECT_EQ(static_cast<unsigned char>(buffer[8]), 0x44);
+    EXPECT_EQ(static_cast<unsigned char>(buffer[12]), 0xA8);
+    EXPECT_EQ(static_cast<unsigned char>(buffer[23]), 0x55);
+
+    const auto [base, size, checksum, delta] = DeltaLayout::decode(buffer);
+    EXPECT_EQ(base, 0x0102030405060708ull);
+    EXPECT_EQ(size, 0x11223344u);
+    EXPECT_EQ(checksum, 0xA1A2A3A4A5A6A7A8ull);
+    EXPECT_EQ(delta, 0x55667788u);
+}
+
+TEST(EntryHeaderTest, VarintEncoding) {
+    HeaderBuffer header;
+    header.appendVarint(0);
+    header.appendVarint(127);
+    header.appendVarint(128);
+    header.appendVarint(300);
+    header.appendVarint(~0ull);
+
+    const std::string expected("\x00\x7f\x80\x01\xac\x02"
+                               "\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01",
+                               16);
+    EXPECT_EQ(std::string(header.data(), header.size()), expected);
+}
+
+TEST(EntryHeaderTest, FuzzMatchesStreamEncoder) {
+    std::mt19937_64 random(20240611);
+    for (int i = 0; i < 20000; ++i) {
+        const HeaderFields fields = randomFields(random);
+        const std::string expected = encodeWithStreamCalls(fields);
+        const std::string actual = encodeWithLayouts(fields);
+        ASSERT_EQ(expected, actual) << "iteration " << i << ", type " << int(fields.type)
+                                    << ", name size " << fields.name.size();
+
+        const auto [type, length] = EntryPrefixLayout::decode(actual.data());
+        ASSERT_EQ(type, fields.type);
+        if (fields.type == 4) {
+            ASSERT_EQ(length, fields.a);
+            continue;
+        }
+        ASSERT_EQ(std::string(actual.data() + EntryPrefixLayout::SIZE, length), fields.name);
+        const char* payload = actual.data() + EntryPrefixLayout::SIZE + length;
+        switch (fields.type) {
+            case 1: {
+                const auto [data_len, checksum] = FileDataLayout::decode(payload);
+                ASSERT_EQ(data_len, static_cast<std::uint32_t>(fields.a));
+                ASSERT_EQ(checksum, fields.b);
+                break;
+            }
+            case 2:
+                ASSERT_EQ(std::get<0>(DuplicateLayout::decode(payload)), fields.a);
+                break;
+            case 5: {
+                const auto [target_len] = SymlinkLayout::decode(payload);
+                ASSERT_EQ(std::string(payload + SymlinkLayout::SIZE, target_len), fields.target);
+                break;
+            }
+            case 10: {
+                const auto [hash_low, hash_high, size] = BlobRefLayout::decode(payload);
+                ASSERT_EQ(hash_low, fields.a);
+                ASSERT_EQ(hash_high, fields.b);
+                ASSERT_EQ(size, fields.c);
+                break;
+            }
+            case 11: {
+                const auto [base, size, checksum, delta] = DeltaLayout::decode(payload);
+                ASSERT_EQ(base, fields.a);
+                ASSERT_EQ(size, static_cast<std::uint32_t>(fields.b));
+                ASSERT_EQ(checksum, fields.c);
+                ASSERT_EQ(delta, static_cast<std::uint32_t>(fields.d));
+                break;
+            }
+            default:
+                ASSERT_EQ(actual.size(), EntryPrefixLayout::SIZE + length);
+                break;
+        }
+    }
+}
+
+TEST(EntryHeaderTest, FuzzPackerRoundTrip) {
+    std::mt19937_64 random(20240612);
+    XXHasher hasher;
+    for (int i = 0; i < 8; ++i) {
+        MemoryTree input = randomTree(random);
+        for (const bool name_table : {false, true}) {
+            PackOptions options;
+            options.name_table = name_table;
+            options.delta_encoding = true;
+            Packer packer{hasher};
+
+            std::vector<char> archive;
+            MemorySinkBuf sink(archive);
+            std::ostream archive_out(&sink);
+            packer.pack(input, archive_out, options);
+
+            SpanIStream verify_in(archive.data(), archive.size());
+            ASSERT_TRUE(packer.verify(verify_in)) << "tree " << i << ", name table " << name_table;
+            SpanIStream archive_in(archive.data(), archive.size());
+            MemoryTree output;
+            packer.unpack(archive_in, output);
+            SCOPED_TRACE("tree " + std::to_string(i) + ", name table " +
+                         std::to_string(name_table));
+            expectSameTree(input.root(), output.root());
+        }
+    }
+}
+
+// Throughput of the per-field stream calls against the field layouts, for encoding and decoding a
+// typical file entry header. Opt-in since timings are no pass/fail criterion: run with
+// PACKER_BENCHMARK=1 set in the environment, in an optimized (Release) build.
+TEST(EntryHeaderTest, BenchmarkEntriesPerSecond) {
+    if (std::getenv("PACKER_BENCHMARK") == nullptr) {
+        GTEST_SKIP() << "set PACKER_BENCHMARK=1 to run";
+    }
+    constexpr int ENTRIES = 2000000;
+    HeaderFields fields;
+    fields.type = 1;
+    fields.name = "libexample.so.1";
+    fields.a = 4096;
+    fields.b = 0x1234567890ABCDEFull;
+
+    auto measure = [&](const char* label, auto encode) {
+        std::ostringstream out;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ENTRIES; ++i) {
+            encode(out);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "encode, " << label << ": "
+                  << static_cast<long long>(ENTRIES / elapsed.count()) << " entries/s ("
+                  << out.tellp() << " bytes)" << std::endl;
+    };
+    measure("stream call per field", [&](std::ostream& out) {
+        out.write(reinterpret_cast<const char*>(&fields.type), 1);
+        write_le16(out, static_cast<std::uint16_t>(fields.name.size()));
+        out.write(fields.name.data(), static_cast<std::streamsize>(fields.name.size()));
+        write_le32(out, static_cast<std::uint32_t>(fields.a));
+        write_le64(out, fields.b);
+    });
+    measure("field layout, single write", [&](std::ostream& out) {
+        HeaderBuffer header;
+        header.append<EntryPrefixLayout>(fields.type,
+                                         static_cast<std::uint16_t>(fields.name.size()));
+        header.appendBytes(fields.name);
+        header.append<FileDataLayout>(static_cast<std::uint32_t>(fields.a), fields.b);
+        header.writeTo(out);
+    });
+
+    std::string encoded;
+    for (int i = 0; i < ENTRIES; ++i) {
+        encoded += encodeWithLayouts(fields);
+    }
+    auto measureDecode = [&](const char* label, auto decode) {
+        std::istringstream in(encoded);
+        std::uint64_t sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ENTRIES; ++i) {
+            sum += decode(in);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "decode, " << label << ": "
+                  << static_cast<long long>(ENTRIES / elapsed.count())
+                  << " entries/s (checksum sum " << sum << ")" << std::endl;
+    };
+    std::string name;
+    measureDecode("stream call per field", [&](std::istream& in) {
+        std::uint8_t type = 0;
+        in.read(reinterpret_cast<char*>(&type), 1);
+        name.resize(read_le16(in));
+        in.read(name.data(), static_cast<std::streamsize>(name.size()));
+        read_le32(in);
+        return read_le64(in);
+    });
+    std::vector<char> buffer;
+    measureDecode("field layout, two reads", [&](std::istream& in) {
+        char prefix[EntryPrefixLayout::SIZE];
+        in.read(prefix, sizeof(prefix));
+        const auto [type, length] = EntryPrefixLayout::decode(prefix);
+        buffer.resize(length + FileDataLayout::SIZE);
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        name.assign(buffer.data(), length);
+        return std::get<1>(FileDataLayout::decode(buffer.data() + length));
+    });
+}
@@ -0,0 +1,106 @@
+#include "filelistinputtree.h"
+
+#include "archivestreams.h"
+#include "memorytree.h"
+#include "packer.h"
+#include "xxhasher.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+class FileListInputTreeTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        root_ = fs::temp_directory_path() /
+                ("packer_filelist_" +
+                 std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(root_);
+        fs::create_directories(root_ / "a/b");
+        fs::create_directories(root_ / "a/unlisted");
+        fs::create_directories(root_ / "c");
+        std::ofstream(root_ / "top.txt") << "top";
+        std::ofstream(root_ / "a/one.txt") << "same content";
+        std::ofstream(root_ / "a/b/two.txt") << "same content";
+        std::ofstream(root_ / "a/unlisted/skip.txt") << "not listed";
+        std::ofstream(root_ / "c/three.txt") << "three";
+    }
+    void TearDown() override { fs::remove_all(root_); }
+
+    // traverse the tree, returning "depth:path" of every visited entry
+    static std::vector<std::string> visitAll(FileListInputTree& tree,
+                                             const fs::path& reject = fs::path()) {
+        std::vector<std::string> visited;
+        tree.traverse([&](const InputEntry& entry) {
+            visited.push_back(std::to_string(entry.depth) + ":" + entry.path.string());
+            return entry.path != reject;
+        });
+        return visited;
+    }
+
+    fs::path root_;
+};
+
+} // namespace
+
+TEST_F(FileListInputTreeTest, ReadsNulSeparatedList) {
+    std::istringstream list(std::string("a/b/two.txt\0top.txt\0\0c/three.txt", 32));
+
+    const std::vector<fs::path> paths = FileListInputTree::readList(list);
+
+    EXPECT_EQ(paths, (std::vector<fs::path>{"a/b/two.txt", "top.txt", "c/three.txt"}));
+}
+
+TEST_F(FileListInputTreeTest, SynthesizesParentDirectoriesInSortedOrder) {
+    FileListInputTree tree(root_, {"top.txt", "./c/three.txt", "a/b/two.txt", "a/one.txt",
+                                   "a/b/two.txt", "a.txt", "."});
+
+    EXPECT_EQ(visitAll(tree), (std::vector<std::string>{"0:a", "1:a/b", "2:a/b/two.txt",
+                                                        "1:a/one.txt", "0:a.txt", "0:c",
+                                                        "1:c/three.txt", "0:top.txt"}));
+}
+
+TEST_F(FileListInputTreeTest, SkipsContentOfRejectedDirectory) {
+    FileListInputTree tree(root_, {"a/b/two.txt", "a/one.txt", "top.txt"});
+
+    EXPECT_EQ(visitAll(tree, "a/b"),
+              (std::vector<std::string>{"0:a", "1:a/b", "1:a/one.txt", "0:top.txt"}));
+}
+
+TEST_F(FileListInputTreeTest, RejectsPathsOutsideRoot) {
+    EXPECT_THROW(FileListInputTree(root_, {"a/../../etc/passwd"}), std::runtime_error);
+    EXPECT_THROW(FileListInputTree(root_, {"/etc/passwd"}), std::runtime_error);
+}
+
+TEST_F(FileListInputTreeTest, PacksOnlyListedFilesWithDeduplication) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    FileListInputTree input(root_, {"a/one.txt", "a/b/two.txt", "c/three.txt"});
+
+    std::vector<char> archive;
+    MemorySinkBuf sink(archive);
+    std::ostream archive_out(&sink);
+    packer.pack(input, archive_out);
+    SpanIStream archive_in(archive.data(), archive.size());
+    MemoryTree output;
+    packer.unpack(archive_in, output);
+
+    ASSERT_NE(output.find("a/b/two.txt"), nullptr);
+    EXPECT_EQ(output.find("a/b/two.txt")->data, "same content");
+    EXPECT_EQ(output.find("c/three.txt")->data, "three");
+    EXPECT_EQ(output.find("a/unlisted"), nullptr);
+    EXPECT_EQ(output.find("top.txt"), nullptr);
+    // the second copy is stored as a duplicate of the first
+    const std::string archive_bytes(archive.begin(), archive.end());
+    const std::size_t first = archive_bytes.find("same content");
+    ASSERT_NE(first, std::string::npos);
+    EXPECT_EQ(archive_bytes.find("same content", first + 1), std::string::npos);
+}
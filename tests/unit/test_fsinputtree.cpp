@@ -0,0 +1,141 @@
+#include "fsinputtree.h"
+
+#include "archivestreams.h"
+#include "locality.h"
+#include "packer.h"
+#include "xxhasher.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+// Input tree charging a simulated seek for every file opened: the distance between its inode
+// and the inode of the file opened before, a stand-in for head movement on a rotational disk
+// where inodes allocated close together tend to be stored close together.
+class SeekCostInputTree : public InputTree {
+  public:
+    SeekCostInputTree(InputTree& tree, fs::path root) : tree_(tree), root_(std::move(root)) {}
+
+    void traverse(const Visitor& visit) override { tree_.traverse(visit); }
+
+    std::uint64_t fileSize(const fs::path& path) const override { return tree_.fileSize(path); }
+    std::unique_ptr<std::istream> openFile(const fs::path& path) const override {
+        const std::uint64_t inode = fileInode(root_ / path);
+        if (last_inode_ != 0) {
+            seek_cost_ += inode > last_inode_ ? inode - last_inode_ : last_inode_ - inode;
+        }
+        last_inode_ = inode;
+        return tree_.openFile(path);
+    }
+    fs::path readSymlink(const fs::path& path) const override { return tree_.readSymlink(path); }
+
+    std::uint64_t seekCost() const { return seek_cost_; }
+
+  private:
+    InputTree& tree_;
+    fs::path root_;
+    mutable std::uint64_t last_inode_ = 0;
+    mutable std::uint64_t seek_cost_ = 0;
+};
+
+class FsInputTreeTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        root_ = fs::temp_directory_path() /
+                ("packer_fsinputtree_" +
+                 std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(root_);
+        // files are created in inode order and then renamed in random order, so directory
+        // order (creation or hash order, depending on the filesystem) differs from inode order
+        std::mt19937 random(2024);
+        for (const fs::path& directory : {fs::path(), fs::path("sub")}) {
+            fs::create_directories(root_ / directory);
+            std::vector<int> order;
+            for (int i = 0; i < 64; ++i) {
+                std::ofstream(root_ / directory / ("tmp" + std::to_string(i)))
+                    << "content of file " << i << " in " << directory;
+                order.push_back(i);
+            }
+            std::shuffle(order.begin(), order.end(), random);
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                fs::rename(root_ / directory / ("tmp" + std::to_string(order[i])),
+                           root_ / directory / ("file" + std::to_string(i)));
+            }
+        }
+        fs::create_symlink("sub", root_ / "link");
+    }
+    void TearDown() override { fs::remove_all(root_); }
+
+    // traverse the tree, returning "depth:path" of every visited entry
+    static std::vector<std::string> visitAll(InputTree& tree) {
+        std::vector<std::string> visited;
+        tree.traverse([&](const InputEntry& entry) {
+            visited.push_back(std::to_string(entry.depth) + ":" + entry.path.string());
+            return true;
+        });
+        return visited;
+    }
+
+    static std::vector<std::uint64_t> sortedFileInodes(const fs::path& directory) {
+        std::vector<std::uint64_t> inodes;
+        for (const fs::directory_entry& entry : fs::directory_iterator(directory)) {
+            if (entry.is_regular_file() && !entry.is_symlink()) {
+                inodes.push_back(fileInode(entry.path()));
+            }
+        }
+        std::sort(inodes.begin(), inodes.end());
+        return inodes;
+    }
+
+    // pack the tree, returning the simulated seek cost of reading its files
+    std::uint64_t packSeekCost(bool locality_order) {
+        XXHasher hasher;
+        Packer packer{hasher};
+        FsInputTree tree(root_, locality_order);
+        SeekCostInputTree input(tree, root_);
+        std::vector<char> archive;
+        MemorySinkBuf sink(archive);
+        std::ostream archive_out(&sink);
+        packer.pack(input, archive_out);
+        return input.seekCost();
+    }
+
+    fs::path root_;
+};
+
+} // namespace
+
+TEST_F(FsInputTreeTest, LocalityOrderVisitsSameEntries) {
+    FsInputTree default_tree(root_);
+    FsInputTree locality_tree(root_, true);
+
+    std::vector<std::string> default_entries = visitAll(default_tree);
+    std::vector<std::string> locality_entries = visitAll(locality_tree);
+
+    EXPECT_EQ(locality_entries.size(), 64u + 1 + 64 + 1);
+    std::sort(default_entries.begin(), default_entries.end());
+    std::sort(locality_entries.begin(), locality_entries.end());
+    EXPECT_EQ(locality_entries, default_entries);
+}
+
+TEST_F(FsInputTreeTest, LocalityOrderReducesSimulatedSeekCost) {
+    const std::uint64_t default_cost = packSeekCost(false);
+    const std::uint64_t locality_cost = packSeekCost(true);
+
+    EXPECT_LT(locality_cost, default_cost);
+    // one sweep over the inodes of each directory's files, top level first
+    const std::vector<std::uint64_t> top = sortedFileInodes(root_);
+    const std::vector<std::uint64_t> sub = sortedFileInodes(root_ / "sub");
+    const std::uint64_t jump = sub.front() > top.back() ? sub.front() - top.back()
+                                                        : top.back() - sub.front();
+    EXPECT_EQ(locality_cost, (top.back() - top.front()) + jump + (sub.back() - sub.front()));
+}
@@ -0,0 +1,196 @@
+#include "fsoutputtree.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+class FsOutputTreeTest : public ::testing::TestWithParam<sync_mode> {
+  protected:
+    void SetUp() override {
+        // parameterized test names contain '/', keep the directory name flat
+        std::string name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        std::replace(name.begin(), name.end(), '/', '_');
+        root_ = fs::temp_directory_path() / ("packer_fsoutputtree_" + name);
+        fs::remove_all(root_);
+        fs::create_directories(root_);
+    }
+    void TearDown() override { fs::remove_all(root_); }
+
+    static std::string readFile(const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    fs::path root_;
+};
+
+} // namespace
+
+TEST_P(FsOutputTreeTest, WritesFilesDirectoriesAndSymlinks) {
+    FsOutputTree tree(root_, GetParam());
+    std::string large(3 * 1024 * 1024 + 11, '\0');
+    for (std::size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<char>(i * 7);
+    }
+
+    tree.createDirectory("a/b");
+    std::istringstream large_in(large);
+    tree.writeFile("a/b/large.bin", large_in, large.size());
+    std::istringstream empty_in("");
+    tree.writeFile("a/empty", empty_in, 0);
+    tree.createSymlink("a/link", "b/large.bin");
+    tree.finish();
+
+    EXPECT_EQ(readFile(root_ / "a/b/large.bin"), large);
+    EXPECT_EQ(fs::file_size(root_ / "a/empty"), 0u);
+    EXPECT_EQ(fs::read_symlink(root_ / "a/link"), fs::path("b/large.bin"));
+}
+
+TEST_P(FsOutputTreeTest, WritesThroughGivenBufferPool) {
+    BufferPool buffers;
+    FsOutputTree tree(root_, GetParam(), 4096, &buffers);
+
+    for (const char* name : {"a", "b", "c"}) {
+        std::istringstream data(std::string(10000, *name));
+        tree.writeFile(name, data, 10000);
+    }
+    tree.finish();
+
+    EXPECT_EQ(readFile(root_ / "c"), std::string(10000, 'c'));
+    EXPECT_EQ(buffers.allocationCount(), 1u);
+}
+
+TEST_P(FsOutputTreeTest, ReplacesLongerExistingFile) {
+    FsOutputTree tree(root_, GetParam());
+    std::ofstream(root_ / "file") << "a much longer previous content";
+
+    std::istringstream data("new");
+    tree.writeFile("file", data, 3);
+    tree.finish();
+
+    EXPECT_EQ(readFile(root_ / "file"), "new");
+}
+
+TEST_P(FsOutputTreeTest, ThrowsOnShortData) {
+    FsOutputTree tree(root_, GetParam());
+
+    std::istringstream data("short");
+    EXPECT_THROW(tree.writeFile("file", data, 100), std::runtime_error);
+}
+
+TEST_P(FsOutputTreeTest, ReplacesEntriesAndReadsThemBack) {
+    FsOutputTree tree(root_, GetParam());
+    std::ofstream(root_ / "file") << "old content";
+    fs::create_symlink("old", root_ / "link");
+
+    std::istringstream data("new");
+    tree.replaceFile("file", data, 3);
+    tree.replaceSymlink("link", "new");
+    tree.createDirectory("dir/sub");
+    tree.finish();
+
+    EXPECT_EQ(readFile(root_ / "file"), "new");
+    EXPECT_EQ(tree.existingFileSize("file"), 3u);
+    EXPECT_EQ(tree.existingSymlinkTarget("link"), fs::path("new"));
+    EXPECT_FALSE(tree.existingFileSize("link"));
+    EXPECT_FALSE(tree.existingSymlinkTarget("file"));
+    std::vector<std::string> names = tree.listDirectory("");
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(names, (std::vector<std::string>{"dir", "file", "link"}));
+
+    tree.removeEntry("dir");
+    EXPECT_FALSE(fs::exists(root_ / "dir"));
+}
+
+TEST_P(FsOutputTreeTest, FailedReplaceKeepsOldFile) {
+    FsOutputTree tree(root_, GetParam());
+    std::ofstream(root_ / "file") << "old content";
+
+    std::istringstream data("short");
+    EXPECT_THROW(tree.replaceFile("file", data, 100), std::runtime_error);
+
+    EXPECT_EQ(readFile(root_ / "file"), "old content");
+    EXPECT_EQ(tree.listDirectory(""), (std::vector<std::string>{"file"}));
+}
+
+TEST_P(FsOutputTreeTest, ReplacesFileWithDirectory) {
+    FsOutputTree tree(root_, GetParam());
+    std::ofstream(root_ / "x") << "was a file";
+    fs::create_symlink("x", root_ / "link");
+
+    tree.replaceDirectory("x/sub");
+    tree.replaceDirectory("link");
+    std::istringstream data("new");
+    tree.replaceFile("x/sub/file", data, 3);
+    tree.finish();
+
+    EXPECT_TRUE(fs::is_directory(fs::symlink_status(root_ / "x")));
+    EXPECT_TRUE(fs::is_directory(fs::symlink_status(root_ / "link")));
+    EXPECT_EQ(readFile(root_ / "x/sub/file"), "new");
+}
+
+TEST_P(FsOutputTreeTest, CreateDirectoryKeepsEntriesInTheWay) {
+    FsOutputTree tree(root_, GetParam());
+    std::ofstream(root_ / "x") << "user file";
+
+    EXPECT_THROW(tree.createDirectory("x/sub"), fs::filesystem_error);
+
+    EXPECT_EQ(readFile(root_ / "x"), "user file");
+}
+
+TEST_P(FsOutputTreeTest, ReplacesDirectoryWithFile) {
+    FsOutputTree tree(root_, GetParam());
+    fs::create_directories(root_ / "x/sub");
+    std::ofstream(root_ / "x/sub/file") << "old content";
+
+    std::istringstream data("new");
+    tree.replaceFile("x", data, 3);
+    tree.finish();
+
+    EXPECT_TRUE(fs::is_regular_file(fs::symlink_status(root_ / "x")));
+    EXPECT_EQ(readFile(root_ / "x"), "new");
+    EXPECT_EQ(tree.listDirectory(""), (std::vector<std::string>{"x"}));
+}
+
+TEST_P(FsOutputTreeTest, ReplacesDirectoryWithSymlink) {
+    FsOutputTree tree(root_, GetParam());
+    fs::create_directories(root_ / "x/sub");
+    std::ofstream(root_ / "x/sub/file") << "old content";
+
+    tree.replaceSymlink("x", "target");
+    tree.finish();
+
+    EXPECT_EQ(tree.existingSymlinkTarget("x"), fs::path("target"));
+    EXPECT_EQ(tree.listDirectory(""), (std::vector<std::string>{"x"}));
+}
+
+TEST_P(FsOutputTreeTest, ReplaceKeepsEntriesNamedLikeTemporaries) {
+    FsOutputTree tree(root_, GetParam());
+    // entries named like temporary files are ordinary archived content
+    std::ofstream(root_ / ".file.packer-tmp") << "archived content";
+    std::ofstream(root_ / ".link.packer-tmp") << "archived content";
+
+    std::istringstream data("new");
+    tree.replaceFile("file", data, 3);
+    tree.replaceSymlink("link", "target");
+    tree.finish();
+
+    EXPECT_EQ(readFile(root_ / ".file.packer-tmp"), "archived content");
+    EXPECT_EQ(readFile(root_ / ".link.packer-tmp"), "archived content");
+    std::vector<std::string> names = tree.listDirectory("");
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(names,
+              (std::vector<std::string>{".file.packer-tmp", ".link.packer-tmp", "file", "link"}));
+}
+
+INSTANTIATE_TEST_SUITE_P(SyncModes, FsOutputTreeTest,
+                         ::testing::Values(sync_mode::none, sync_mode::end, sync_mode::batch));
@@ -0,0 +1,82 @@
+#include "hashworkerpool.h"
+#include "xxhasher.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+static std::vector<char> to_vector(const std::string& s) {
+    return std::vector<char>(s.begin(), s.end());
+}
+
+TEST(HashWorkerPoolTest, NoJobsReportsNoMismatches) {
+    XXHasher hasher;
+    HashWorkerPool pool(hasher, 2, 1024);
+
+    EXPECT_TRUE(pool.finish().empty());
+}
+
+TEST(HashWorkerPoolTest, ReportsOnlyMismatchingOffsetsInOrder) {
+    XXHasher hasher;
+    HashWorkerPool pool(hasher, 4, 64);
+
+    for (int i = 0; i < 100; ++i) {
+        const std::string data = "payload " + std::to_string(i);
+        auto expected = hasher.compute_hash(data.data(), data.size());
+        if (i == 42 || i == 7) {
+            expected ^= 1; // corrupt the expected value
+        }
+        pool.submit(i * 10, expected, to_vector(data));
+    }
+
+    EXPECT_EQ(pool.finish(), (std::vector<std::streamoff>{70, 420}));
+}
+
+TEST(HashWorkerPoolTest, AcceptsJobLargerThanLimit) {
+    XXHasher hasher;
+    HashWorkerPool pool(hasher, 1, 4);
+
+    const std::string data(1000, 'z');
+    pool.submit(1, hasher.compute_hash(data.data(), data.size()), to_vector(data));
+    pool.submit(2, hasher.compute_hash(data.data(), data.size()), to_vector(data));
+
+    EXPECT_TRUE(pool.finish().empty());
+}
+
+TEST(HashWorkerPoolTest, ChecksStreamsOfChunks) {
+    XXHasher hasher;
+    HashWorkerPool pool(hasher, 3, 64);
+
+    std::string data;
+    for (int i = 0; i < 1000; ++i) {
+        data += "chunked payload " + std::to_string(i) + "\n";
+    }
+    const auto expected = hasher.compute_hash(data.data(), data.size());
+    // two streams interleaved, the second one with a corrupted chunk
+    const HashWorkerPool::StreamId good = pool.beginStream(10, expected);
+    const HashWorkerPool::StreamId bad = pool.beginStream(20, expected);
+    for (std::size_t offset = 0; offset < data.size(); offset += 100) {
+        const std::string chunk = data.substr(offset, 100);
+        pool.submitChunk(good, to_vector(chunk));
+        pool.submitChunk(bad, to_vector(offset == 500 ? std::string(chunk.size(), '?') : chunk));
+    }
+    pool.endStream(good);
+    pool.endStream(bad);
+
+    EXPECT_EQ(pool.finish(), (std::vector<std::streamoff>{20}));
+}
+
+TEST(HashWorkerPoolTest, CancelledStreamHasNoVerdict) {
+    XXHasher hasher;
+    HashWorkerPool pool(hasher, 2, 64);
+
+    const HashWorkerPool::StreamId stream = pool.beginStream(30, 0);
+    pool.submitChunk(stream, to_vector("partial payload"));
+    pool.cancelStream(stream);
+    pool.submit(40, hasher.compute_hash("ok", 2), to_vector("ok"));
+
+    EXPECT_TRUE(pool.finish().empty());
+}
@@ -0,0 +1,71 @@
+#include "iotuning.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace packer;
+
+namespace {
+
+class IoTuningTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        dir_ = fs::temp_directory_path() /
+               ("packer_iotuning_" +
+                std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+        fs::remove_all(dir_);
+        fs::create_directories(dir_);
+    }
+    void TearDown() override { fs::remove_all(dir_); }
+
+    fs::path dir_;
+};
+
+} // namespace
+
+TEST_F(IoTuningTest, SaveAndLoadRoundTrip) {
+    IoTuning tuning;
+    tuning.read_chunk_size = 256 * 1024;
+    tuning.hash_chunk_size = 16 * 1024;
+    tuning.write_chunk_size = 4 * 1024 * 1024;
+
+    saveIoTuning(tuning, dir_ / "config" / "io_tuning");
+    const IoTuning loaded = loadIoTuning(dir_ / "config" / "io_tuning");
+
+    EXPECT_EQ(loaded.read_chunk_size, tuning.read_chunk_size);
+    EXPECT_EQ(loaded.hash_chunk_size, tuning.hash_chunk_size);
+    EXPECT_EQ(loaded.write_chunk_size, tuning.write_chunk_size);
+}
+
+TEST_F(IoTuningTest, MissingFileYieldsDefaults) {
+    const IoTuning loaded = loadIoTuning(dir_ / "missing");
+
+    EXPECT_EQ(loaded.read_chunk_size, IoTuning{}.read_chunk_size);
+    EXPECT_EQ(loaded.write_chunk_size, IoTuning{}.write_chunk_size);
+}
+
+TEST_F(IoTuningTest, RejectsInvalidSettings) {
+    for (const std::string content : {"read_chunk_size=12abc\n", "read_chunk_size=1\n",
+                                      "unknown=65536\n", "no separator\n"}) {
+        std::ofstream(dir_ / "io_tuning") << content;
+        EXPECT_THROW(loadIoTuning(dir_ / "io_tuning"), std::runtime_error) << content;
+    }
+}
+
+TEST_F(IoTuningTest, CalibrationPicksMeasuredSizesAndRemovesSample) {
+    std::ostringstream report;
+    const IoTuning tuning = calibrateIoTuning(dir_, 1024 * 1024, report);
+
+    for (const std::size_t size :
+         {tuning.read_chunk_size, tuning.hash_chunk_size, tuning.write_chunk_size}) {
+        EXPECT_GE(size, IoTuning::MIN_CHUNK_SIZE);
+        EXPECT_LE(size, IoTuning::MAX_CHUNK_SIZE);
+    }
+    EXPECT_NE(report.str().find("hash chunk"), std::string::npos);
+    EXPECT_TRUE(fs::is_empty(dir_));
+}
@@ -0,0 +1,52 @@
+#include "nametable.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+TEST(NameTableTest, AssignsIdsInOrderAndKeepsViewsStable) {
+    NameTable table;
+    std::vector<std::string_view> views;
+    for (int i = 0; i < 20000; ++i) {
+        views.push_back(table.add("name_" + std::to_string(i), true));
+    }
+    // long names get a block of their own
+    const std::string long_name(100000, 'x');
+    EXPECT_EQ(table.add(long_name, true), long_name);
+
+    for (int i = 0; i < 20000; ++i) {
+        EXPECT_EQ(views[i], "name_" + std::to_string(i));
+        EXPECT_EQ(table.get(i).data(), views[i].data());
+    }
+    EXPECT_EQ(table.find("name_1234"), 1234u);
+    EXPECT_EQ(table.find(long_name), 20000u);
+    EXPECT_FALSE(table.find("missing"));
+    EXPECT_THROW(table.get(20001), std::runtime_error);
+}
+
+TEST(NameTableTest, UnindexedNamesAreNotFound) {
+    NameTable table;
+    table.add("index.js");
+
+    EXPECT_EQ(table.get(0), "index.js");
+    EXPECT_FALSE(table.find("index.js"));
+}
+
+TEST(NameTableTest, TruncateForgetsLaterNames) {
+    NameTable table;
+    table.add("a", true);
+    table.add("b", true);
+    table.add("c", true);
+
+    table.truncate(1);
+
+    EXPECT_EQ(table.size(), 1u);
+    EXPECT_EQ(table.find("a"), 0u);
+    EXPECT_FALSE(table.find("b"));
+    EXPECT_EQ(table.add("c", true), "c");
+    EXPECT_EQ(table.find("c"), 1u);
+}
@@ -0,0 +1,506 @@
+#include "packer.h"
+
+#include "archivestreams.h"
+#include "blobstore.h"
+#include "memorytree.h"
+#include "xxhasher.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+namespace {
+
+MemoryTree sampleTree() {
+    MemoryTree tree;
+    tree.addFile("top.txt", "top level file");
+    tree.addFile("a/one.txt", "same content");
+    tree.addFile("a/b/two.txt", "same content");
+    tree.addFile("a/b/empty.dat", "");
+    tree.addDirectory("a/empty_dir");
+    tree.addSymlink("a/link", "b/two.txt");
+    tree.addFile("c/deep/data.bin", std::string(200000, 'x'));
+    return tree;
+}
+
+std::vector<char> packToMemory(Packer& packer, MemoryTree& tree,
+                               const PackOptions& options = {}) {
+    std::vector<char> archive;
+    MemorySinkBuf sink(archive);
+    std::ostream archive_out(&sink);
+    packer.pack(tree, archive_out, options);
+    return archive;
+}
+
+MemoryTree unpackFromMemory(Packer& packer, const std::vector<char>& archive,
+                            const UnpackOptions& options = {}) {
+    SpanIStream archive_in(archive.data(), archive.size());
+    MemoryTree output;
+    packer.unpack(archive_in, output, options);
+    return output;
+}
+
+// compare two memory trees node by node
+void expectSameTree(const MemoryTree::Node& expected, const MemoryTree::Node& actual,
+                    const std::string& path = "") {
+    EXPECT_EQ(expected.type, actual.type) << path;
+    EXPECT_EQ(expected.data, actual.data) << path;
+    ASSERT_EQ(expected.children.size(), actual.children.size()) << path;
+    for (const auto& [name, child] : expected.children) {
+        const auto it = actual.children.find(name);
+        ASSERT_NE(it, actual.children.end()) << path + "/" + name;
+        expectSameTree(child, it->second, path + "/" + name);
+    }
+}
+
+std::size_t countOccurrences(const std::vector<char>& haystack, const std::string& needle) {
+    std::size_t count = 0;
+    auto it = haystack.begin();
+    while ((it = std::search(it, haystack.end(), needle.begin(), needle.end())) !=
+           haystack.end()) {
+        ++count;
+        ++it;
+    }
+    return count;
+}
+
+// memory tree counting how often each file is opened for reading
+class OpenCountingMemoryTree : public MemoryTree {
+  public:
+    std::unique_ptr<std::istream> openFile(const fs::path& path) const override {
+        ++opens[path.generic_string()];
+        return MemoryTree::openFile(path);
+    }
+
+    mutable std::map<std::string, int> opens;
+};
+
+} // namespace
+
+TEST(PackerTest, MemoryRoundTrip) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+
+    const std::vector<char> archive = packToMemory(packer, input);
+    MemoryTree output = unpackFromMemory(packer, archive);
+
+    expectSameTree(input.root(), output.root());
+}
+
+TEST(PackerTest, TinyChunkSizesRoundTrip) {
+    // chunks smaller than most files exercise the chunk loops
+    const XXHasher hasher;
+    IoTuning tuning;
+    tuning.read_chunk_size = 5;
+    tuning.hash_chunk_size = 7;
+    Packer packer{hasher, tuning};
+    MemoryTree input = sampleTree();
+
+    const std::vector<char> archive = packToMemory(packer, input);
+    MemoryTree output = unpackFromMemory(packer, archive);
+
+    expectSameTree(input.root(), output.root());
+    EXPECT_EQ(countOccurrences(archive, "same content"), 1u);
+}
+
+TEST(PackerTest, DuplicateContentIsStoredOnce) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+
+    const std::vector<char> archive = packToMemory(packer, input);
+
+    EXPECT_EQ(countOccurrences(archive, "same content"), 1u);
+}
+
+TEST(PackerTest, CallbackSinkProducesSameArchive) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+
+    std::vector<char> streamed;
+    {
+        CallbackSinkBuf sink(
+            [&](const char* data, std::size_t size) {
+                streamed.insert(streamed.end(), data, data + size);
+            },
+            4096);
+        std::ostream archive_out(&sink);
+        packer.pack(input, archive_out);
+    }
+
+    EXPECT_EQ(streamed, packToMemory(packer, input));
+}
+
+TEST(PackerTest, UnpackThroughReadCallback) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+    const std::vector<char> archive = packToMemory(packer, input);
+
+    CallbackSourceBuf source(
+        [&](std::uint64_t offset, char* data, std::size_t size) {
+            if (offset >= archive.size()) {
+                return std::size_t{0};
+            }
+            const std::size_t n = std::min<std::size_t>(size, archive.size() - offset);
+            std::memcpy(data, archive.data() + offset, n);
+            return n;
+        },
+        1024);
+    std::istream archive_in(&source);
+    MemoryTree output;
+    packer.unpack(archive_in, output);
+
+    expectSameTree(input.root(), output.root());
+}
+
+TEST(PackerTest, VerifyDetectsCorruptedMemoryArchive) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+    std::vector<char> archive = packToMemory(packer, input);
+
+    {
+        SpanIStream archive_in(archive.data(), archive.size());
+        EXPECT_TRUE(packer.verify(archive_in));
+    }
+
+    const std::string content = "top level file";
+    auto it = std::search(archive.begin(), archive.end(), content.begin(), content.end());
+    ASSERT_NE(it, archive.end());
+    *it ^= 0x20;
+
+    SpanIStream archive_in(archive.data(), archive.size());
+    EXPECT_FALSE(packer.verify(archive_in));
+}
+
+TEST(PackerTest, VerifyChecksLargeFileDataInChunks) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input;
+    std::string large(20 * 1024 * 1024 + 5, '\0');
+    for (std::size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<char>(i * 7 + (i >> 13));
+    }
+    input.addFile("large.bin", large);
+    std::vector<char> archive = packToMemory(packer, input);
+    {
+        SpanIStream archive_in(archive.data(), archive.size());
+        EXPECT_TRUE(packer.verify(archive_in));
+    }
+
+    // corrupt a byte in the last chunk
+    archive[archive.size() - 3] ^= 1;
+    SpanIStream archive_in(archive.data(), archive.size());
+    EXPECT_FALSE(packer.verify(archive_in));
+}
+
+TEST(PackerTest, UnpackWithIncludeFilter) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+    const std::vector<char> archive = packToMemory(packer, input);
+
+    UnpackOptions options;
+    options.include_patterns = {"a/b"};
+    MemoryTree output = unpackFromMemory(packer, archive, options);
+
+    ASSERT_EQ(output.root().children.size(), 1u);
+    const MemoryTree::Node* two = output.find("a/b/two.txt");
+    ASSERT_NE(two, nullptr);
+    EXPECT_EQ(two->data, "same content");
+    EXPECT_EQ(output.find("a/one.txt"), nullptr);
+    EXPECT_EQ(output.find("a/empty_dir"), nullptr);
+}
+
+TEST(PackerTest, UnpackRejectsNamesLeavingTheOutputDirectory) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input;
+    input.addFile("QZ/passwd", "replaced");
+    const std::vector<char> archive = packToMemory(packer, input);
+    const auto name = std::search(archive.begin(), archive.end(), "QZ", "QZ" + 2);
+    ASSERT_NE(name, archive.end());
+
+    for (const std::string& bad_name :
+         {std::string(".."), std::string("a/"), std::string("\0x", 2)}) {
+        std::vector<char> crafted = archive;
+        std::copy(bad_name.begin(), bad_name.end(), crafted.begin() + (name - archive.begin()));
+        {
+            SpanIStream archive_in(crafted.data(), crafted.size());
+            EXPECT_FALSE(packer.verify(archive_in));
+        }
+        MemoryTree output;
+        SpanIStream archive_in(crafted.data(), crafted.size());
+        EXPECT_THROW(packer.unpack(archive_in, output), std::runtime_error);
+        EXPECT_TRUE(output.root().children.empty());
+    }
+}
+
+TEST(PackerTest, BlobStoreRoundTripAndExport) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+    const fs::path store_root = fs::temp_directory_path() / "packer_test_blob_store";
+    fs::remove_all(store_root);
+
+    {
+        BlobStore store(store_root);
+        PackOptions pack_options;
+        pack_options.store = &store;
+        std::vector<char> archive;
+        {
+            MemorySinkBuf sink(archive);
+            std::ostream archive_out(&sink);
+            packer.pack(input, archive_out, pack_options);
+        }
+        // file data lives in the store only
+        EXPECT_EQ(countOccurrences(archive, "same content"), 0u);
+        EXPECT_EQ(store.blobCount(), 4u);
+        EXPECT_THROW(unpackFromMemory(packer, archive), std::runtime_error);
+
+        UnpackOptions unpack_options;
+        unpack_options.store = &store;
+        MemoryTree output = unpackFromMemory(packer, archive, unpack_options);
+        expectSameTree(input.root(), output.root());
+
+        std::vector<char> exported;
+        {
+            SpanIStream archive_in(archive.data(), archive.size());
+            MemorySinkBuf sink(exported);
+            std::ostream exported_out(&sink);
+            packer.exportArchive(archive_in, store, exported_out);
+        }
+        EXPECT_EQ(countOccurrences(exported, "same content"), 1u);
+        {
+            SpanIStream exported_in(exported.data(), exported.size());
+            EXPECT_TRUE(packer.verify(exported_in));
+        }
+        MemoryTree exported_output = unpackFromMemory(packer, exported);
+        expectSameTree(input.root(), exported_output.root());
+
+        SpanIStream archive_in(archive.data(), archive.size());
+        EXPECT_TRUE(packer.releaseArchive(archive_in, store));
+        store.collectGarbage();
+        EXPECT_EQ(store.blobCount(), 0u);
+    }
+    fs::remove_all(store_root);
+}
+
+TEST(PackerTest, BlobStoreKeepsDataOfCollidingKeysInArchive) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input;
+    input.addFile("lib.so", "shared library");
+    const fs::path store_root = fs::temp_directory_path() / "packer_test_blob_store_collision";
+    fs::remove_all(store_root);
+
+    {
+        BlobStore store(store_root);
+        PackOptions pack_options;
+        pack_options.store = &store;
+        packToMemory(packer, input, pack_options);
+        store.save();
+        // the stored bytes no longer match their key, as if different data had the same key
+        std::fstream segment(store_root / "segments" / "00000001.seg",
+                             std::ios::binary | std::ios::in | std::ios::out);
+        segment.write("X", 1);
+        segment.close();
+
+        const std::vector<char> archive = packToMemory(packer, input, pack_options);
+        EXPECT_EQ(countOccurrences(archive, "shared library"), 1u);
+        EXPECT_EQ(store.blobCount(), 1u);
+
+        UnpackOptions unpack_options;
+        unpack_options.store = &store;
+        MemoryTree output = unpackFromMemory(packer, archive, unpack_options);
+        expectSameTree(input.root(), output.root());
+
+        std::vector<char> exported;
+        {
+            SpanIStream archive_in(archive.data(), archive.size());
+            MemorySinkBuf sink(exported);
+            std::ostream exported_out(&sink);
+            packer.exportArchive(archive_in, store, exported_out);
+        }
+        SpanIStream exported_in(exported.data(), exported.size());
+        EXPECT_TRUE(packer.verify(exported_in));
+        expectSameTree(input.root(), unpackFromMemory(packer, exported).root());
+    }
+    fs::remove_all(store_root);
+}
+
+TEST(PackerTest, DeltaEncodingOfSimilarFiles) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    std::string config;
+    for (int i = 0; i < 2000; ++i) {
+        config += "option_" + std::to_string(i) + " = " + std::to_string(i * 31) + "\n";
+    }
+    std::string variant = config;
+    variant.replace(variant.find("option_1000"), 11, "changed_one");
+    MemoryTree input;
+    input.addFile("base.conf", config);
+    input.addFile("hosts/variant.conf", variant);
+
+    PackOptions options;
+    options.delta_encoding = true;
+    std::vector<char> archive;
+    {
+        MemorySinkBuf sink(archive);
+        std::ostream archive_out(&sink);
+        packer.pack(input, archive_out, options);
+    }
+    EXPECT_LT(archive.size(), config.size() + config.size() / 10);
+
+    MemoryTree output = unpackFromMemory(packer, archive);
+    expectSameTree(input.root(), output.root());
+    {
+        SpanIStream archive_in(archive.data(), archive.size());
+        EXPECT_TRUE(packer.verify(archive_in));
+    }
+
+    // the delta inserts the changed bytes literally
+    const std::string changed = "changed_one";
+    auto it = std::search(archive.begin(), archive.end(), changed.begin(), changed.end());
+    ASSERT_NE(it, archive.end());
+    *it ^= 0x20;
+    SpanIStream archive_in(archive.data(), archive.size());
+    EXPECT_FALSE(packer.verify(archive_in));
+}
+
+TEST(PackerTest, DeltaEncodingReadsBasesOfCloseCandidatesOnly) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    std::string config;
+    for (int i = 0; i < 2000; ++i) {
+        config += "option_" + std::to_string(i) + " = " + std::to_string(i * 31) + "\n";
+    }
+    std::string variant = config;
+    variant.replace(variant.find("option_1000"), 11, "changed_one");
+    OpenCountingMemoryTree input;
+    input.addFile("a/base.conf", config);
+    input.addFile("b/variant.conf", variant);
+    for (int i = 0; i < 20; ++i) {
+        std::mt19937 random(i);
+        std::string unrelated(4096, '\0');
+        for (char& c : unrelated) {
+            c = static_cast<char>(random());
+        }
+        input.addFile("c/unrelated" + std::to_string(i), unrelated);
+    }
+
+    PackOptions options;
+    options.delta_encoding = true;
+    std::vector<char> archive;
+    {
+        MemorySinkBuf sink(archive);
+        std::ostream archive_out(&sink);
+        packer.pack(input, archive_out, options);
+    }
+
+    // every file is read once, the base of the variant once more
+    EXPECT_EQ(input.opens["a/base.conf"], 2);
+    EXPECT_EQ(input.opens["b/variant.conf"], 1);
+    EXPECT_EQ(input.opens["c/unrelated7"], 1);
+    EXPECT_LT(archive.size(), config.size() + config.size() / 10 + 20 * 4096 + 1024);
+    expectSameTree(input.root(), unpackFromMemory(packer, archive).root());
+}
+
+TEST(PackerTest, NameTableStoresRepeatedNamesOnce) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input;
+    for (int i = 0; i < 50; ++i) {
+        const std::string module = "node_modules/module_" + std::to_string(i);
+        input.addFile(module + "/index.js", "module.exports = " + std::to_string(i) + ";");
+        input.addFile(module + "/package.json", "{\"name\": \"" + std::to_string(i) + "\"}");
+        input.addFile(module + "/LICENSE", "MIT");
+        input.addSymlink(module + "/lib/main.js", "../index.js");
+    }
+
+    const std::vector<char> plain = packToMemory(packer, input);
+    PackOptions options;
+    options.name_table = true;
+    std::vector<char> archive;
+    {
+        MemorySinkBuf sink(archive);
+        std::ostream archive_out(&sink);
+        packer.pack(input, archive_out, options);
+    }
+
+    EXPECT_EQ(countOccurrences(archive, "package.json"), 1u);
+    EXPECT_EQ(countOccurrences(archive, "main.js"), 1u);
+    EXPECT_LT(archive.size(), plain.size() * 3 / 4);
+    MemoryTree output = unpackFromMemory(packer, archive);
+    expectSameTree(input.root(), output.root());
+    SpanIStream archive_in(archive.data(), archive.size());
+    EXPECT_TRUE(packer.verify(archive_in));
+
+    // a reference to a name id that was never defined is rejected
+    std::vector<char> corrupted(archive.begin(), archive.begin() + 6);
+    corrupted.push_back(static_cast<char>(file_type::directory));
+    corrupted.push_back(static_cast<char>(5 << 1 | 1));
+    SpanIStream corrupted_in(corrupted.data(), corrupted.size());
+    EXPECT_FALSE(packer.verify(corrupted_in));
+}
+
+namespace {
+
+// memory tree counting the files and symlinks written into it
+class CountingMemoryTree : public MemoryTree {
+  public:
+    void writeFile(const fs::path& path, std::istream& data, std::uint64_t size) override {
+        ++writes;
+        MemoryTree::writeFile(path, data, size);
+    }
+    void createSymlink(const fs::path& path, const fs::path& target) override {
+        ++writes;
+        MemoryTree::createSymlink(path, target);
+    }
+
+    int writes = 0;
+};
+
+} // namespace
+
+TEST(PackerTest, UpdateRewritesOnlyChangedEntries) {
+    XXHasher hasher;
+    Packer packer{hasher};
+    MemoryTree input = sampleTree();
+    const std::vector<char> archive = packToMemory(packer, input);
+
+    CountingMemoryTree output;
+    {
+        SpanIStream archive_in(archive.data(), archive.size());
+        packer.unpack(archive_in, output);
+    }
+    output.addFile("a/b/two.txt", "same length!");
+    output.addFile("top.txt", "different length");
+    output.addSymlink("a/link", "elsewhere");
+    output.addFile("a/stale.txt", "not in the archive");
+    output.addFile("c/deep/stale_dir/file", "not in the archive");
+    output.writes = 0;
+
+    UnpackOptions options;
+    options.update = true;
+    options.remove_stale = true;
+    SpanIStream archive_in(archive.data(), archive.size());
+    packer.unpack(archive_in, output, options);
+
+    expectSameTree(input.root(), output.root());
+    EXPECT_EQ(output.writes, 3);
+}
@@ -0,0 +1,61 @@
+#include "pathfilter.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using namespace packer;
+
+// selection of a path, computed by descending from the root one component at a time
+static bool selects(const PathFilter& filter, const std::string& path) {
+    PathFilter::Selection selection = filter.root();
+    fs::path relative;
+    for (const auto& component : fs::path(path)) {
+        relative /= component;
+        selection = filter.select(selection, relative);
+    }
+    return selection.selected();
+}
+
+TEST(PathFilterTest, EmptyFilterSelectsEverything) {
+    PathFilter filter({}, {});
+
+    EXPECT_TRUE(filter.selectsAll());
+    EXPECT_TRUE(selects(filter, "a"));
+    EXPECT_TRUE(selects(filter, "a/b/c.txt"));
+}
+
+TEST(PathFilterTest, IncludedDirectorySelectsItsContent) {
+    PathFilter filter({"a/b"}, {});
+
+    EXPECT_FALSE(selects(filter, "a"));
+    EXPECT_TRUE(selects(filter, "a/b"));
+    EXPECT_TRUE(selects(filter, "a/b/c/d.txt"));
+    EXPECT_FALSE(selects(filter, "a/bc"));
+    EXPECT_FALSE(selects(filter, "x/a/b"));
+}
+
+TEST(PathFilterTest, PatternWithoutSlashMatchesNameAtAnyDepth) {
+    PathFilter filter({"*.txt"}, {});
+
+    EXPECT_TRUE(selects(filter, "top.txt"));
+    EXPECT_TRUE(selects(filter, "a/b/deep.txt"));
+    EXPECT_FALSE(selects(filter, "a/b/deep.dat"));
+}
+
+TEST(PathFilterTest, WildcardDoesNotCrossDirectories) {
+    PathFilter filter({"a/*.txt"}, {});
+
+    EXPECT_TRUE(selects(filter, "a/x.txt"));
+    EXPECT_FALSE(selects(filter, "a/b/x.txt"));
+}
+
+TEST(PathFilterTest, ExcludeWinsOverInclude) {
+    PathFilter filter({"a"}, {"*.bak", "a/skip"});
+
+    EXPECT_TRUE(selects(filter, "a/keep.txt"));
+    EXPECT_FALSE(selects(filter, "a/old.bak"));
+    EXPECT_FALSE(selects(filter, "a/skip"));
+    EXPECT_FALSE(selects(filter, "a/skip/anything.txt"));
+}
@@ -0,0 +1,64 @@
+#include "similarityindex.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+using namespace packer;
+
+namespace {
+
+std::string randomContent(std::size_t size, unsigned seed) {
+    std::mt19937 random(seed);
+    std::string content(size, '\0');
+    for (char& c : content) {
+        c = static_cast<char>(random());
+    }
+    return content;
+}
+
+SimilarityIndex::Sketch sketchOf(const std::string& content) {
+    return SimilarityIndex::computeSketch(content.data(), content.size());
+}
+
+} // namespace
+
+TEST(SimilarityIndexTest, FindsSimilarContentOnly) {
+    const std::string original = randomContent(32 * 1024, 1);
+    std::string edited = original;
+    edited[1000] ^= 1;
+    edited[20000] ^= 1;
+    const std::string unrelated = randomContent(32 * 1024, 2);
+
+    SimilarityIndex index;
+    index.add(sketchOf(unrelated), {"unrelated", 10, unrelated.size(), 0});
+    index.add(sketchOf(original), {"original", 20, original.size(), 0});
+
+    const std::vector<SimilarityIndex::Entry> found = index.find(sketchOf(edited), 4);
+    ASSERT_EQ(found.size(), 1u);
+    EXPECT_EQ(found[0].path, fs::path("original"));
+    EXPECT_EQ(found[0].data_offset, 20);
+
+    EXPECT_TRUE(index.find(sketchOf(randomContent(32 * 1024, 3)), 4).empty());
+
+    index.clear();
+    EXPECT_TRUE(index.find(sketchOf(edited), 4).empty());
+}
+
+TEST(SimilarityIndexTest, EmptySketchesAreNeverFound) {
+    const SimilarityIndex::Sketch empty = sketchOf("too short");
+    ASSERT_TRUE(SimilarityIndex::isEmpty(empty));
+    const std::string content = randomContent(4096, 4);
+    ASSERT_FALSE(SimilarityIndex::isEmpty(sketchOf(content)));
+
+    SimilarityIndex index;
+    index.add(empty, {"short", 10, 9, 0});
+    index.add(sketchOf(content), {"content", 20, content.size(), 0});
+
+    EXPECT_TRUE(index.find(empty, 4).empty());
+    const std::vector<SimilarityIndex::Entry> found =
+        index.find(sketchOf(content), 4, SimilarityIndex::SKETCH_SIZE);
+    ASSERT_EQ(found.size(), 1u);
+    EXPECT_EQ(found[0].path, fs::path("content"));
+}
@@ -5,6 +5,8 @@
 
 #include <xxhash.h>
 
+#include <algorithm>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -80,4 +82,25 @@ TEST(XXHasherTest, HandlesMultiChunkInput) {
 
     const hash_value_t expected = static_cast<hash_value_t>(XXH3_64bits(data.data(), data.size()));
     EXPECT_EQ(result, expected);
-}
\ No newline at end of file
+}
+
+TEST(XXHasherTest, BufferHashMatchesStreamHash) {
+    XXHasher hasher;
+    const std::string data = "The quick brown fox jumps over the lazy dog";
+
+    std::istringstream input(data);
+    EXPECT_EQ(hasher.compute_hash(data.data(), data.size()), hasher.compute_hash(input));
+}
+
+TEST(XXHasherTest, StateMatchesOneShotHash) {
+    XXHasher hasher;
+    const std::string data(10000, 'z');
+
+    const std::unique_ptr<StreamHasher::State> state = hasher.start();
+    for (std::size_t offset = 0; offset < data.size(); offset += 999) {
+        state->update(data.data() + offset, std::min<std::size_t>(999, data.size() - offset));
+    }
+
+    EXPECT_EQ(state->digest(), hasher.compute_hash(data.data(), data.size()));
+    EXPECT_EQ(hasher.start()->digest(), hasher.compute_hash("", 0));
+}